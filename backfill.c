@@ -0,0 +1,324 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "callbacks.h"
+#include "err.h"
+#include "fs.h"
+#include "netdata.h"
+#include "tai.h"
+#include "backfill.h"
+
+/* Rotated files of multilog are named by the TAI64N label of their rotation,
+ * so their names sort by time. Archives compressed later keep the name with
+ * a suffix and are read through the decompressor. */
+static
+const struct {
+	const char * suffix;
+	const char * command;
+} archives[] = {
+	{ ".s",     NULL   },
+	{ ".s.gz",  "gzip" },
+	{ ".s.zst", "zstd" },
+};
+
+#define LEN(x) ( sizeof x / sizeof * x )
+
+struct input {
+	FILE * file;
+	pid_t pid;
+	char * line;
+	size_t size;
+	long time;                   /* of the row in line, -1 at the end */
+};
+
+static
+int
+archive_type(const char * name) {
+	size_t len, suffix;
+	int i;
+
+	if (name[0] != '@')
+		return -1;
+
+	len = strlen(name);
+	for (i = 0; i < LEN(archives); i++) {
+		suffix = strlen(archives[i].suffix);
+		if (len > suffix && !strcmp(name + len - suffix, archives[i].suffix))
+			return i;
+	}
+
+	return -1;
+}
+
+static
+int
+is_archive(const struct dirent * de) {
+	return archive_type(de->d_name) >= 0;
+}
+
+/* Compressed archives are read from a pipe, the decompressor runs in
+ * parallel with the parser. */
+static
+FILE *
+open_log(const char * dir, const char * name, pid_t * pid) {
+	char path[PATH_MAX];
+	const char * command;
+	int fds[2];
+	int type;
+
+	snprintf(path, sizeof path, "%s/%s", dir, name);
+	*pid = 0;
+
+	type = archive_type(name);
+	if (type < 0 || archives[type].command == NULL)
+		return fopen(path, "r");
+
+	command = archives[type].command;
+	if (pipe(fds) == -1) {
+		perror("pipe");
+		return NULL;
+	}
+
+	*pid = fork();
+	if (*pid == -1) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return NULL;
+	}
+	if (*pid == 0) {
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execlp(command, command, "-dc", "--", path, (char *)NULL);
+		fprintf(stderr, "Cannot run %s: %s\n", command, strerror(errno));
+		_exit(1);
+	}
+
+	close(fds[1]);
+	return fdopen(fds[0], "r");
+}
+
+static
+void
+close_log(FILE * file, const pid_t pid) {
+	fclose(file);
+	if (pid > 0)
+		waitpid(pid, NULL, 0);
+}
+
+/* The modules see the end of the second as the current time, so their
+ * windows and expirations follow the log. */
+static
+int
+emit(struct fs_watch * watch, const uint64_t second) {
+	int ret;
+
+	tai_set_now((second + 1) * 1000000 - 1);
+	nd_csv(second);
+
+	if (watch->func->postprocess)
+		watch->func->postprocess(watch->data);
+
+	ret = watch->func->print(watch->dir_name, watch->data, 1000000);
+	watch->func->clear(watch->data);
+
+	return ret;
+}
+
+/* The data of the module is created again at the time of the first labelled
+ * line, as the modules start their windows at the current time. */
+static
+int
+restart(struct fs_watch * watch, const uint64_t time) {
+	tai_set_now(time);
+	watch->func->fini(watch->data);
+	watch->data = watch->func->init();
+
+	return watch->data == NULL;
+}
+
+/* Lines are counted in the second of their TAI64N label. A line without a
+ * label or older than the previous one stays in the current second. */
+static
+int
+backfill_file(struct fs_watch * watch, FILE * file, uint64_t * second) {
+	char * line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	uint64_t time;
+	int ret = 0;
+
+	while (!ret && (len = getline(&line, &size, file)) != -1) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (len >= BUFSIZ)
+			line[BUFSIZ - 1] = '\0';
+
+		if (!tai64n_parse(line, &time)) {
+			if (!*second && restart(watch, time)) {
+				fprintf(stderr, "Cannot allocate data for '%s'\n", watch->dir_name);
+				ret = 1;
+				break;
+			}
+			if (*second && time / 1000000 > *second)
+				ret = emit(watch, *second);
+			if (time / 1000000 > *second)
+				*second = time / 1000000;
+			tai_set_now(time);
+		}
+
+		watch->func->process(line, watch->data);
+	}
+
+	free(line);
+	return ret;
+}
+
+static
+int
+backfill_dir(struct fs_watch * watch) {
+	struct dirent ** list;
+	const char * name;
+	uint64_t second = 0;
+	FILE * file;
+	pid_t pid;
+	int ret = 0;
+	int i, n;
+
+	n = scandir(watch->dir_name, &list, &is_archive, &alphasort);
+	if (n == -1) {
+		fprintf(stderr, "Cannot read directory '%s': %s\n", watch->dir_name, strerror(errno));
+		return 1;
+	}
+
+	/* The charts are announced once, so the rows follow their dimensions */
+	nd_csv(0);
+	ret = watch->func->print_hdr(watch->dir_name);
+
+	for (i = 0; i <= n && !ret; i++) {
+		name = i < n ? list[i]->d_name : watch->file_name;
+
+		file = open_log(watch->dir_name, name, &pid);
+		if (file == NULL) {
+			fprintf(stderr, "Cannot open '%s/%s': %s\n", watch->dir_name, name, strerror(errno));
+			continue;
+		}
+
+		fprintf(stderr, "backfilling %s/%s\n", watch->dir_name, name);
+		ret = backfill_file(watch, file, &second);
+		close_log(file, pid);
+	}
+
+	for (i = 0; i < n; i++)
+		free(list[i]);
+	free(list);
+
+	if (!ret && second)
+		ret = emit(watch, second);
+	else if (!second)
+		fprintf(stderr, "No TAI64N labelled lines in '%s'\n", watch->dir_name);
+
+	return ret || fflush(stdout);
+}
+
+static
+void
+read_row(struct input * in) {
+	if (in->file == NULL || getline(&in->line, &in->size, in->file) == -1)
+		in->time = -1;
+	else
+		in->time = strtol(in->line, NULL, 10);
+}
+
+/* Every log directory is parsed by its own process, the parent merges their
+ * rows, which are sorted by time already. */
+enum nd_err
+backfill(struct fs_watch * watchers, size_t watchers_length) {
+	enum nd_err ret = ND_SUCCESS;
+	struct input * inputs;
+	struct input * next;
+	int fds[2];
+	int status;
+	int i;
+
+	inputs = calloc(watchers_length, sizeof * inputs);
+	if (inputs == NULL)
+		return ND_ALLOC;
+
+	fflush(stdout);
+	for (i = 0; i < watchers_length; i++) {
+		if (pipe(fds) == -1) {
+			perror("pipe");
+			ret = ND_ERROR;
+			break;
+		}
+
+		inputs[i].pid = fork();
+		if (inputs[i].pid == -1) {
+			perror("fork");
+			close(fds[0]);
+			close(fds[1]);
+			ret = ND_ERROR;
+			break;
+		}
+		if (inputs[i].pid == 0) {
+			dup2(fds[1], STDOUT_FILENO);
+			close(fds[0]);
+			close(fds[1]);
+			exit(backfill_dir(&watchers[i]));
+		}
+
+		close(fds[1]);
+		inputs[i].file = fdopen(fds[0], "r");
+		if (inputs[i].file == NULL)
+			perror("fdopen");
+	}
+	watchers_length = i;
+
+	/* The first rows are read once every child runs, so they parse together */
+	for (i = 0; i < watchers_length; i++)
+		read_row(&inputs[i]);
+
+	puts("time,chart,dimension,value");
+	for (;;) {
+		next = NULL;
+		for (i = 0; i < watchers_length; i++)
+			if (inputs[i].time >= 0 && (next == NULL || inputs[i].time < next->time))
+				next = &inputs[i];
+		if (next == NULL)
+			break;
+
+		if (fputs(next->line, stdout) == EOF) {
+			fprintf(stderr, "Cannot write to stdout: %s\n", strerror(errno));
+			ret = ND_ERROR;
+			break;
+		}
+		read_row(next);
+	}
+
+	for (i = 0; i < watchers_length; i++) {
+		if (inputs[i].file)
+			fclose(inputs[i].file);
+		free(inputs[i].line);
+		if (waitpid(inputs[i].pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status))
+			ret = ND_ERROR;
+	}
+	free(inputs);
+
+	if (fflush(stdout))
+		ret = ND_ERROR;
+
+	return ret;
+}
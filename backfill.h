@@ -0,0 +1,3 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+enum nd_err backfill(struct fs_watch *, size_t);
@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "bucket.h"
+
+/* The ring is sized for the lateness, the first open bucket is the one of
+ * now minus the lateness. */
+enum nd_err
+buckets_init(struct buckets * b, const size_t fields, const uint64_t width,
+		const uint64_t lateness, const uint64_t now) {
+	b->len = lateness + 2 > BUCKET_SLOTS ? lateness + 2 : BUCKET_SLOTS;
+	b->counts = calloc(b->len * fields, sizeof * b->counts);
+	b->closed = calloc(b->len * fields, sizeof * b->closed);
+	if (b->counts == NULL || b->closed == NULL) {
+		buckets_free(b);
+		return ND_ALLOC;
+	}
+
+	b->fields = fields;
+	b->width = width;
+	b->lateness = lateness;
+	b->next = now / width - b->lateness;
+	b->late = 0;
+	b->closed_len = 0;
+	return ND_SUCCESS;
+}
+
+static inline
+long *
+bucket_row(struct buckets * b, const uint64_t bucket) {
+	return b->counts + (bucket % b->len) * b->fields;
+}
+
+/* Events too far in the future for the ring go to its newest bucket */
+void
+buckets_add(struct buckets * b, const uint64_t time, const size_t field) {
+	uint64_t bucket = time / b->width;
+
+	if (bucket < b->next) {
+		bucket = b->next;
+		b->late++;
+	} else if (bucket >= b->next + b->len) {
+		bucket = b->next + b->len - 1;
+	}
+
+	bucket_row(b, bucket)[field]++;
+}
+
+/* Closes the buckets ended more than the lateness before now, their counters
+ * are kept for buckets_emit until the next close. After a gap longer than the
+ * ring, as when the clock jumps, the ring is dropped and nothing is closed. */
+void
+buckets_close(struct buckets * b, const uint64_t now) {
+	const uint64_t open = now / b->width - b->lateness;
+	long * row;
+
+	b->closed_len = 0;
+	if (open > b->next + b->len) {
+		memset(b->counts, 0, b->len * b->fields * sizeof * b->counts);
+		b->next = open;
+		return;
+	}
+
+	for (; b->next < open; b->next++) {
+		row = bucket_row(b, b->next);
+		memcpy(b->closed + b->closed_len++ * b->fields, row, b->fields * sizeof * row);
+		memset(row, 0, b->fields * sizeof * row);
+	}
+}
+
+/* emit gets the counters of each closed bucket and the microseconds since the
+ * previous one. */
+void
+buckets_emit(const struct buckets * b, void (*emit)(const long *, unsigned long, void *), void * data) {
+	size_t i;
+
+	for (i = 0; i < b->closed_len; i++)
+		emit(b->closed + i * b->fields, b->width, data);
+}
+
+void
+buckets_free(struct buckets * b) {
+	free(b->counts);
+	free(b->closed);
+	b->counts = NULL;
+	b->closed = NULL;
+}
@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+/* Counters of events by the time they happened rather than the tick which
+ * read them. Buckets of one tick stay open for the lateness window, then they
+ * are closed in order. Events older than the oldest open bucket are counted
+ * into it as late. The ring has at least BUCKET_SLOTS rows, more if the
+ * lateness needs them. */
+#define BUCKET_SLOTS 64
+
+struct buckets {
+	size_t fields;       /* counters per bucket */
+	size_t len;          /* rows of the ring, more than lateness + 1 */
+	uint64_t width;      /* microseconds of a bucket */
+	uint64_t lateness;   /* buckets kept open after their end */
+	uint64_t next;       /* oldest open bucket, time / width */
+	long * counts;       /* len rows of fields counters */
+	long late;           /* late events since the last close */
+	size_t closed_len;   /* rows closed by the last close */
+	long * closed;       /* len rows, oldest first */
+};
+
+enum nd_err buckets_init(struct buckets *, const size_t, const uint64_t, const uint64_t, const uint64_t);
+void buckets_add(struct buckets *, const uint64_t, const size_t);
+void buckets_close(struct buckets *, const uint64_t);
+void buckets_emit(const struct buckets *, void (*)(const long *, unsigned long, void *), void *);
+void buckets_free(struct buckets *);
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <errno.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "cnproc.h"
+
+/* The proc connector reports process events by netlink. Subscription needs
+ * root or CAP_NET_ADMIN, -1 is returned otherwise. */
+static
+int
+cnproc_subscribe(const int fd, const enum proc_cn_mcast_op op) {
+	char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof op)] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr * hdr = (struct nlmsghdr *)buf;
+	struct cn_msg * msg;
+
+	memset(buf, 0, sizeof buf);
+	hdr->nlmsg_len = NLMSG_LENGTH(sizeof * msg + sizeof op);
+	hdr->nlmsg_type = NLMSG_DONE;
+	hdr->nlmsg_pid = getpid();
+
+	msg = NLMSG_DATA(hdr);
+	msg->id.idx = CN_IDX_PROC;
+	msg->id.val = CN_VAL_PROC;
+	msg->len = sizeof op;
+	memcpy(msg->data, &op, sizeof op);
+
+	return send(fd, hdr, hdr->nlmsg_len, 0) == hdr->nlmsg_len ? 0 : -1;
+}
+
+int
+prepare_cnproc_fd() {
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+	if (fd == -1) {
+		fprintf(stderr, "Cannot open proc connector: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof addr);
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid = getpid();
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof addr) == -1
+			|| cnproc_subscribe(fd, PROC_CN_MCAST_LISTEN) == -1) {
+		fprintf(stderr, "Cannot subscribe to proc connector: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Calls the callback with pid and wait status of every exited process. Exits
+ * of other threads than the main one are skipped. */
+void
+process_cnproc_events(const int fd, void (*exited)(const pid_t, const int, void *), void * data) {
+	char buf[BUFSIZ] __attribute__((aligned(NLMSG_ALIGNTO)));
+	const struct proc_event * event;
+	const struct nlmsghdr * hdr;
+	const struct cn_msg * msg;
+	ssize_t len;
+
+	while ((len = recv(fd, buf, sizeof buf, 0)) > 0) {
+		for (hdr = (const struct nlmsghdr *)buf; NLMSG_OK(hdr, len); hdr = NLMSG_NEXT(hdr, len)) {
+			if (hdr->nlmsg_type == NLMSG_ERROR || hdr->nlmsg_type == NLMSG_NOOP)
+				continue;
+
+			msg = NLMSG_DATA(hdr);
+			if (msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC)
+				continue;
+
+			event = (const struct proc_event *)msg->data;
+			if (event->what == PROC_EVENT_EXIT
+					&& event->event_data.exit.process_pid == event->event_data.exit.process_tgid)
+				exited(event->event_data.exit.process_pid, event->event_data.exit.exit_code, data);
+		}
+	}
+
+	/* ENOBUFS means that events were lost, there is nothing to recover */
+	if (len == -1 && errno != EAGAIN && errno != ENOBUFS)
+		fprintf(stderr, "Cannot read proc connector: %s\n", strerror(errno));
+}
+
+void
+close_cnproc_fd(const int fd) {
+	if (fd == -1)
+		return;
+
+	cnproc_subscribe(fd, PROC_CN_MCAST_IGNORE);
+	close(fd);
+}
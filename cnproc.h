@@ -0,0 +1,5 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+int prepare_cnproc_fd();
+void process_cnproc_events(const int, void (*)(const pid_t, const int, void *), void *);
+void close_cnproc_fd(const int);
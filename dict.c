@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "hash.h"
+#include "table.h"
+#include "vector.h"
+#include "dict.h"
+
+enum nd_err
+dict_init(struct dict * d) {
+	if (table_init(&d->index, sizeof(uint32_t)) != ND_SUCCESS)
+		return ND_ALLOC;
+
+	if (vector_init(&d->names, sizeof(char *)) != ND_SUCCESS) {
+		table_free(&d->index);
+		return ND_ALLOC;
+	}
+
+	return ND_SUCCESS;
+}
+
+/* Looks up the slot of the string in the index. Two strings with the same
+ * hash are told apart by hashing the key again, so the lookup compares one
+ * string in the usual case. The returned id is NULL if the string is not
+ * present, key is then the free key to add it with. */
+static
+uint32_t *
+dict_lookup(struct dict * d, const char * str, const size_t len, uint64_t * key) {
+	const char * name;
+	uint32_t * id;
+
+	for (*key = hash_mem(str, len);; *key = hash_u64(*key)) {
+		*key = *key ? *key : 1;
+		id = table_find(&d->index, *key);
+		if (id == NULL)
+			return NULL;
+		name = dict_name(d, *id);
+		if (!strncmp(name, str, len) && name[len] == '\0')
+			return id;
+	}
+}
+
+/* Returns id of the string or -1 if it is not present */
+long
+dict_find(struct dict * d, const char * str, const size_t len) {
+	uint32_t * id;
+	uint64_t key;
+
+	id = dict_lookup(d, str, len, &key);
+	return id ? (long)*id : -1;
+}
+
+/* Returns id of the string, the string is added if it is not present yet. -1
+ * is returned if memory cannot be allocated. */
+long
+dict_intern(struct dict * d, const char * str, const size_t len) {
+	uint32_t * id;
+	uint64_t key;
+	char * copy;
+
+	id = dict_lookup(d, str, len, &key);
+	if (id)
+		return *id;
+
+	copy = strndup(str, len);
+	if (copy == NULL || vector_add(&d->names, &copy) != ND_SUCCESS) {
+		free(copy);
+		return -1;
+	}
+
+	id = table_insert(&d->index, key);
+	if (id == NULL) {
+		free(copy);
+		d->names.len--;
+		return -1;
+	}
+
+	*id = d->names.len - 1;
+	return *id;
+}
+
+void
+dict_free(struct dict * d) {
+	size_t i;
+
+	for (i = 0; i < d->names.len; i++)
+		free(*(char **)vector_item(&d->names, i));
+	vector_free(&d->names);
+	table_free(&d->index);
+}
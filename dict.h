@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+/* Dictionary of interned strings. Every distinct string gets a small integer
+ * id, which can be used as a key of other tables instead of the string. Ids
+ * are assigned from 0 and never released. */
+struct dict {
+	struct table index;  /* hash of string -> id */
+	struct vector names; /* id -> string */
+};
+
+#define DICT_EMPTY { .index = TABLE_EMPTY, .names = VECTOR_EMPTY }
+
+static inline
+int
+dict_is_init(struct dict * d) {
+	return d && table_is_init(&d->index);
+}
+
+static inline
+const char *
+dict_name(const struct dict * d, const uint32_t id) {
+	return ((const char * const *)d->names.data)[id];
+}
+
+enum nd_err
+dict_init(struct dict *);
+
+long
+dict_find(struct dict *, const char *, const size_t);
+
+long
+dict_intern(struct dict *, const char *, const size_t);
+
+void
+dict_free(struct dict *);
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "env.h"
+
+/* Plugins are started by netdata with fixed arguments, so optional tunables are
+ * taken from the environment. The default is returned if the variable is not
+ * set or it is not a number, a number out of [min, max] is clamped. */
+int
+env_int(const char * name, const int def, const int min, const int max) {
+	const char * val;
+	char * end;
+	long ret;
+
+	val = getenv(name);
+	if (val == NULL || *val == '\0')
+		return def;
+
+	errno = 0;
+	ret = strtol(val, &end, 10);
+	if (*end != '\0') {
+		fprintf(stderr, "Ignoring invalid value of %s: '%s'\n", name, val);
+		return def;
+	}
+
+	if (errno == ERANGE || ret < min || ret > max) {
+		ret = ret < min ? min : max;
+		fprintf(stderr, "Value of %s out of range [%d, %d]: '%s', using %ld\n", name, min, max, val, ret);
+	}
+
+	return ret;
+}
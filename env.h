@@ -0,0 +1,3 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+int env_int(const char *, const int, const int, const int);
@@ -2,6 +2,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,6 +14,8 @@
 #include "callbacks.h"
 #include "err.h"
 #include "fs.h"
+#include "netdata.h"
+#include "tai.h"
 
 int
 is_directory(const char * name) {
@@ -41,6 +44,56 @@ prepare_fs_event_fd() {
 	return fd;
 }
 
+/* Lines labelled by multilog t tell how late they are read, the label is
+ * decoded only for watchers which record the times. */
+static inline
+void
+note_line_time(struct fs_watch * watch, const char * line) {
+	uint64_t time;
+
+	if (!watch->record_times || tai64n_parse(line, &time))
+		return;
+
+	if (!watch->oldest || time < watch->oldest)
+		watch->oldest = time;
+	if (time > watch->newest)
+		watch->newest = time;
+}
+
+void
+clear_line_times(struct fs_watch * watch) {
+	watch->oldest = 0;
+	watch->newest = 0;
+}
+
+void
+print_lag_hdr(const struct fs_watch * watch, const char * type) {
+	char context[BUFSIZ];
+	char title[BUFSIZ];
+
+	sprintf(title, "Log lag behind real time for %s", watch->dir_name);
+	sprintf(context, "%s.log_lag", type);
+	nd_chart(type, watch->dir_name, "lag", "log lag", title, "seconds",
+		"lag", context, ND_CHART_TYPE_LINE);
+	nd_dimension("newest", "newest line", ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+	nd_dimension("oldest", "oldest line", ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+}
+
+/* Lag of the newest and the oldest line read in the tick, in milliseconds.
+ * Values are left empty in ticks without labelled lines. */
+void
+print_lag(struct fs_watch * watch, const char * type, const unsigned long time) {
+	const uint64_t now = tai_now_us();
+
+	nd_begin_time(type, watch->dir_name, "lag", time);
+	if (watch->newest) {
+		nd_set("newest", now > watch->newest ? (now - watch->newest) / 1000 : 0);
+		nd_set("oldest", now > watch->oldest ? (now - watch->oldest) / 1000 : 0);
+	}
+	nd_end();
+	clear_line_times(watch);
+}
+
 enum nd_err
 read_log_file(struct fs_watch * watch) {
 	ssize_t  max_line_length;
@@ -61,9 +114,10 @@ read_log_file(struct fs_watch * watch) {
 			if (end) {
 				*end = '\0';
 
-				if (watch->skip == DO_NOT_SKIP)
+				if (watch->skip == DO_NOT_SKIP) {
+					note_line_time(watch, line);
 					watch->func->process(line, watch->data);
-				else
+				} else
 					watch->skip = DO_NOT_SKIP;
 
 				line = end + 1;
@@ -74,8 +128,10 @@ read_log_file(struct fs_watch * watch) {
 				} else if (max_line_length == sizeof watch->buf) {
 					watch->buf[sizeof watch->buf - 1] = '\0';
 
-					if (watch->skip == DO_NOT_SKIP)
+					if (watch->skip == DO_NOT_SKIP) {
+						note_line_time(watch, line);
 						watch->func->process(line, watch->data);
+					}
 
 					watch->skip = SKIP_THE_REST;
 				}
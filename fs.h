@@ -3,6 +3,7 @@
 enum watch_type {
 	WATCH_LOG_FILE,
 	WATCH_QUEUE,
+	WATCH_PROC,
 };
 
 enum skip {
@@ -22,10 +23,16 @@ struct fs_watch {
 	void * data;
 	const struct stat_func * func;
 	enum watch_type type;
+	int record_times;            /* set by plugins which chart the lag */
+	uint64_t oldest;             /* TAI64N times of lines read in the tick */
+	uint64_t newest;             /* in microseconds, 0 if there was none */
 };
 
 int is_directory(const char *);
 
 enum nd_err read_log_file(struct fs_watch *);
+void clear_line_times(struct fs_watch *);
+void print_lag_hdr(const struct fs_watch *, const char *);
+void print_lag(struct fs_watch *, const char *, const unsigned long);
 int prepare_fs_event_fd();
 void process_fs_event_queue(const int, struct fs_watch *, size_t);
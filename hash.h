@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+/* The functions are defined here, so the header includes their types */
+#include <stddef.h>
+#include <stdint.h>
+
+/* FNV-1a hash of a memory span. */
+static inline
+uint64_t
+hash_mem(const void * mem, const size_t len) {
+	const unsigned char * p = mem;
+	uint64_t h = 14695981039346656037ULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+/* Finalizer of splitmix64. It spreads bits of an integer key, so it can be used
+ * directly as an index into a power of two sized table. */
+static inline
+uint64_t
+hash_u64(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "histogram.h"
+
+static inline
+unsigned
+bucket_of(const uint32_t value) {
+	unsigned exp;
+
+	if (value < HISTOGRAM_SUB)
+		return value;
+
+	exp = 31 - __builtin_clz(value);
+	return (exp - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB
+		+ ((value >> (exp - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB - 1));
+}
+
+/* Middle of the bucket */
+static inline
+uint32_t
+value_of(const unsigned bucket) {
+	unsigned exp, width;
+
+	if (bucket < HISTOGRAM_SUB)
+		return bucket;
+
+	exp = bucket / HISTOGRAM_SUB + HISTOGRAM_SUB_BITS - 1;
+	width = 1U << (exp - HISTOGRAM_SUB_BITS);
+	return (HISTOGRAM_SUB + bucket % HISTOGRAM_SUB) * width + width / 2;
+}
+
+/* Values above 32 bits are counted in the last bucket */
+void
+histogram_add(struct histogram * h, uint64_t value) {
+	if (value > UINT32_MAX)
+		value = UINT32_MAX;
+
+	h->count[bucket_of(value)]++;
+	h->total++;
+	if (h->max < value)
+		h->max = value;
+}
+
+void
+histogram_merge(struct histogram * dst, const struct histogram * src) {
+	size_t i;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+		dst->count[i] += src->count[i];
+	dst->total += src->total;
+	if (dst->max < src->max)
+		dst->max = src->max;
+}
+
+/* Value below which the given per mille of values lies, 0 if empty. The
+ * result never exceeds the maximum. */
+uint32_t
+histogram_percentile(const struct histogram * h, const unsigned permille) {
+	uint64_t rank, seen = 0;
+	uint32_t value;
+	size_t i;
+
+	if (!h->total)
+		return 0;
+
+	rank = (h->total * permille + 999) / 1000;
+	rank = rank ? rank : 1;
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += h->count[i];
+		if (seen >= rank)
+			break;
+	}
+
+	value = value_of(i < HISTOGRAM_BUCKETS ? i : HISTOGRAM_BUCKETS - 1);
+	return value < h->max ? value : h->max;
+}
+
+void
+histogram_clear(struct histogram * h) {
+	memset(h, 0, sizeof * h);
+}
@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+/* Log-linear histogram of 32 bit values. Values below 16 have their own
+ * bucket, bigger ones are split into 16 buckets per power of two, so a value
+ * is read back with a relative error below 1/32. */
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((32 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB)
+
+struct histogram {
+	uint32_t count[HISTOGRAM_BUCKETS];
+	uint64_t total;
+	uint32_t max;
+};
+
+void histogram_add(struct histogram *, uint64_t);
+void histogram_merge(struct histogram *, const struct histogram *);
+uint32_t histogram_percentile(const struct histogram *, const unsigned);
+void histogram_clear(struct histogram *);
@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "hash.h"
+#include "table.h"
+#include "hitters.h"
+
+enum nd_err
+hitters_init(struct hitters * h, const size_t k) {
+	h->k = k ? k : 1;
+	h->len = 0;
+	h->total = 0;
+	h->heap = calloc(h->k, sizeof * h->heap);
+	if (h->heap == NULL)
+		return ND_ALLOC;
+
+	if (table_init(&h->index, sizeof(size_t)) != ND_SUCCESS) {
+		free(h->heap);
+		h->heap = NULL;
+		return ND_ALLOC;
+	}
+
+	return ND_SUCCESS;
+}
+
+static
+void
+hitters_set(struct hitters * h, const size_t i, const struct hitter * item) {
+	h->heap[i] = *item;
+	*(size_t *)table_find(&h->index, item->key) = i;
+}
+
+/* The count of a counter only grows, so it moves towards the leaves. */
+static
+void
+sift_down(struct hitters * h, size_t i) {
+	struct hitter item = h->heap[i];
+	size_t child;
+
+	while ((child = 2 * i + 1) < h->len) {
+		if (child + 1 < h->len && h->heap[child + 1].count < h->heap[child].count)
+			child++;
+		if (item.count <= h->heap[child].count)
+			break;
+		hitters_set(h, i, h->heap + child);
+		i = child;
+	}
+	hitters_set(h, i, &item);
+}
+
+static
+void
+sift_up(struct hitters * h, size_t i) {
+	struct hitter item = h->heap[i];
+
+	while (i > 0 && h->heap[(i - 1) / 2].count > item.count) {
+		hitters_set(h, i, h->heap + (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+	hitters_set(h, i, &item);
+}
+
+static
+void
+set_name(struct hitter * item, const char * name, size_t len) {
+	if (len >= HITTER_NAME_MAX)
+		len = HITTER_NAME_MAX - 1;
+	memcpy(item->name, name, len);
+	item->name[len] = '\0';
+}
+
+/* Costs one hash, one table probe and O(log k) heap steps. Two names with the
+ * same 64 bit hash share a counter. */
+void
+hitters_offer(struct hitters * h, const char * name, const size_t len) {
+	struct hitter * min;
+	uint64_t key;
+	size_t * pos;
+
+	key = hash_mem(name, len);
+	key = key ? key : 1;
+	h->total++;
+
+	pos = table_find(&h->index, key);
+	if (pos) {
+		h->heap[*pos].count++;
+		sift_down(h, *pos);
+		return;
+	}
+
+	if (h->len < h->k) {
+		if (table_insert(&h->index, key) == NULL)
+			return;
+		min = h->heap + h->len++;
+		min->key = key;
+		min->count = 1;
+		min->error = 0;
+		set_name(min, name, len);
+		sift_up(h, h->len - 1);
+		return;
+	}
+
+	/* The new name inherits the smallest count as its error. It is indexed
+	 * before the old one is removed, so a failed insert keeps the heap and
+	 * the index consistent. */
+	min = h->heap;
+	if (table_insert(&h->index, key) == NULL)
+		return;
+	table_remove(&h->index, min->key);
+	min->key = key;
+	min->error = min->count;
+	min->count++;
+	set_name(min, name, len);
+	sift_down(h, 0);
+}
+
+/* Upper bound of overestimation of any count, the smallest count once all
+ * counters are used. It never exceeds total / k. */
+long
+hitters_error(const struct hitters * h) {
+	return h->len < h->k ? 0 : h->heap[0].count;
+}
+
+void
+hitters_clear(struct hitters * h) {
+	h->len = 0;
+	h->total = 0;
+	table_clear(&h->index);
+}
+
+void
+hitters_free(struct hitters * h) {
+	free(h->heap);
+	h->heap = NULL;
+	table_free(&h->index);
+}
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#define HITTER_NAME_MAX 64
+
+struct hitter {
+	uint64_t key;                /* hash of the name */
+	long count;                  /* estimated count, never underestimated */
+	long error;                  /* maximal overestimation of count */
+	char name[HITTER_NAME_MAX];
+};
+
+/* Space-Saving summary of the k most frequent names of a stream. The counters
+ * form a min-heap, a new name takes over the smallest counter once all k are
+ * used. The memory is fixed by k whatever the number of distinct names is. */
+struct hitters {
+	size_t k;
+	size_t len;
+	long total;                  /* number of offered names */
+	struct hitter * heap;
+	struct table index;          /* key -> position in heap */
+};
+
+enum nd_err hitters_init(struct hitters *, const size_t);
+void hitters_offer(struct hitters *, const char *, const size_t);
+long hitters_error(const struct hitters *);
+void hitters_clear(struct hitters *);
+void hitters_free(struct hitters *);
@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "hll.h"
+#include "tai.h"
+
+/* The value has to be a well mixed hash. The top HLL_BITS select a register,
+ * which keeps the longest run of leading zeros of the rest plus one. */
+void
+hll_add(struct hll * h, const uint64_t hash) {
+	const uint64_t rest = hash << HLL_BITS;
+	const uint8_t rank = rest ? __builtin_clzll(rest) + 1 : 64 - HLL_BITS + 1;
+	uint8_t * reg = &h->reg[hash >> (64 - HLL_BITS)];
+
+	if (*reg < rank)
+		*reg = rank;
+}
+
+/* The union of two sets is the maximum of their registers. */
+void
+hll_merge(struct hll * dst, const struct hll * src) {
+	size_t i;
+
+	/* Without a branch the loop is vectorized */
+	for (i = 0; i < HLL_REGISTERS; i++)
+		dst->reg[i] = dst->reg[i] < src->reg[i] ? src->reg[i] : dst->reg[i];
+}
+
+/* Raw estimate alpha * m^2 / sum(2^-reg), small cardinalities are estimated
+ * by linear counting of empty registers. The registers are counted by value
+ * first, so the powers are summed once per value. */
+long
+hll_estimate(const struct hll * h) {
+	const double m = HLL_REGISTERS;
+	const double alpha = 0.7213 / (1 + 1.079 / m);
+	uint32_t counts[64 - HLL_BITS + 2] = { 0 };
+	double sum = 0, estimate;
+	size_t i, zeros;
+
+	for (i = 0; i < HLL_REGISTERS; i++)
+		counts[h->reg[i]]++;
+
+	for (i = 0; i < sizeof counts / sizeof * counts; i++)
+		sum += ldexp(counts[i], -(int)i);
+	zeros = counts[0];
+
+	estimate = alpha * m * m / sum;
+	if (estimate <= 2.5 * m && zeros)
+		estimate = m * log(m / zeros);
+
+	return estimate + 0.5;
+}
+
+void
+hll_clear(struct hll * h) {
+	memset(h->reg, 0, sizeof h->reg);
+}
+
+static
+uint64_t
+current_slot() {
+	const uint64_t fixed = tai_fixed_now();
+	struct timespec now;
+
+	if (fixed)
+		return fixed / 1000000 / HLL_SLOT;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec / HLL_SLOT;
+}
+
+void
+hll_window_init(struct hll_window * w) {
+	memset(w, 0, sizeof * w);
+	w->current = current_slot();
+}
+
+void
+hll_window_add(struct hll_window * w, const uint64_t hash) {
+	hll_add(&w->tick, hash);
+	hll_add(&w->slot[w->current % HLL_WINDOW_SLOTS], hash);
+}
+
+/* Values of the tick of src are added to the tick and the current slot of dst,
+ * the window of src is not merged. */
+void
+hll_window_merge(struct hll_window * dst, const struct hll_window * src) {
+	hll_merge(&dst->tick, &src->tick);
+	hll_merge(&dst->slot[dst->current % HLL_WINDOW_SLOTS], &src->tick);
+}
+
+/* Slots which left the window are emptied, it is called once per tick. */
+void
+hll_window_advance(struct hll_window * w) {
+	const uint64_t slot = current_slot();
+
+	while (w->current < slot) {
+		w->current++;
+		hll_clear(&w->slot[w->current % HLL_WINDOW_SLOTS]);
+		if (slot - w->current >= HLL_WINDOW_SLOTS)
+			w->current = slot - HLL_WINDOW_SLOTS;
+	}
+}
+
+long
+hll_window_estimate(const struct hll_window * w) {
+	struct hll sum;
+	size_t i;
+
+	sum = w->slot[0];
+	for (i = 1; i < HLL_WINDOW_SLOTS; i++)
+		hll_merge(&sum, &w->slot[i]);
+
+	return hll_estimate(&sum);
+}
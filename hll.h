@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+/* HyperLogLog with 2^HLL_BITS one byte registers, the standard error of the
+ * estimate is 1.04 / sqrt(2^HLL_BITS), 1.6 %. */
+#define HLL_BITS 12
+#define HLL_REGISTERS (1 << HLL_BITS)
+
+struct hll {
+	uint8_t reg[HLL_REGISTERS];
+};
+
+/* Distinct values of the current tick and of the last HLL_WINDOW_SLOTS slots
+ * of HLL_SLOT seconds. Both sketches get every value, so adding costs two
+ * register updates. */
+#define HLL_SLOT 30
+#define HLL_WINDOW_SLOTS 10
+
+struct hll_window {
+	struct hll tick;
+	struct hll slot[HLL_WINDOW_SLOTS];
+	uint64_t current;            /* monotonic or backfilled log time / HLL_SLOT */
+};
+
+void hll_add(struct hll *, const uint64_t);
+void hll_merge(struct hll *, const struct hll *);
+long hll_estimate(const struct hll *);
+void hll_clear(struct hll *);
+
+void hll_window_init(struct hll_window *);
+void hll_window_add(struct hll_window *, const uint64_t);
+void hll_window_merge(struct hll_window *, const struct hll_window *);
+void hll_window_advance(struct hll_window *);
+long hll_window_estimate(const struct hll_window *);
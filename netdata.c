@@ -1,8 +1,14 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "err.h"
+#include "hash.h"
 #include "netdata.h"
+#include "table.h"
+#include "vector.h"
 
 static
 const char *
@@ -21,6 +27,36 @@ nd_charttype_str[] = {
 	"stacked",
 };
 
+/* Backfill writes "time,chart,dimension,value" rows for the second in
+ * csv_time instead of the protocol, which has no absolute time. The rows
+ * carry what netdata would chart: the dimensions announced by nd_dimension()
+ * keep their algorithm, values are multiplied and divided, incremental ones
+ * become the change per second and percentages of the row are computed at
+ * nd_end(). */
+#define CSV_ID_MAX 256
+
+struct csv_dimension {
+	enum nd_algorithm algorithm;
+	int multiplier;
+	int divisor;
+	long last;                   /* previous value of incremental ones */
+	int has_last;
+};
+
+struct csv_set {
+	char id[CSV_ID_MAX];
+	long value;
+	struct csv_dimension * dimension; /* NULL if it was not announced */
+	double scaled;
+	int valid;                   /* 0 for the first incremental value */
+};
+
+static long csv_time = -1;
+static char csv_chart[BUFSIZ];
+static uint64_t csv_chart_key;
+static struct table csv_dimensions = TABLE_EMPTY; /* by csv_key() */
+static struct vector csv_row = VECTOR_EMPTY;      /* sets since nd_begin() */
+
 static
 const char *
 check_null(const char * str) {
@@ -36,10 +72,149 @@ print_type_prefix_id(const char * type, const char * prefix, const char * id) {
 		printf("%s.%s", type, check_null(prefix));
 }
 
+void
+nd_csv(const long time) {
+	csv_time = time;
+}
+
+static
+void
+csv_set_chart(const char * type, const char * prefix, const char * id) {
+	if (id)
+		snprintf(csv_chart, sizeof csv_chart, "%s.%s_%s", type, check_null(prefix), id);
+	else
+		snprintf(csv_chart, sizeof csv_chart, "%s.%s", type, check_null(prefix));
+	csv_chart_key = hash_u64(hash_mem(csv_chart, strlen(csv_chart)));
+	csv_row.len = 0;
+}
+
+/* Key 0 is reserved by the table */
+static
+uint64_t
+csv_key(const char * id) {
+	const uint64_t key = csv_chart_key ^ hash_mem(id, strlen(id));
+
+	return key ? key : 1;
+}
+
+/* A dimension announced again keeps its previous value, so repeated charts of
+ * new dimensions do not restart the incremental ones. */
+static
+void
+csv_dimension(const char * id, enum nd_algorithm alg, int multiplier, int divisor) {
+	struct csv_dimension * d;
+	const uint64_t key = csv_key(id);
+
+	if (!table_is_init(&csv_dimensions) && table_init(&csv_dimensions, sizeof * d) != ND_SUCCESS) {
+		fprintf(stderr, "Cannot allocate dimensions, '%s.%s' is written as is\n", csv_chart, id);
+		return;
+	}
+
+	d = table_find(&csv_dimensions, key);
+	if (d == NULL) {
+		d = table_insert(&csv_dimensions, key);
+		if (d == NULL) {
+			fprintf(stderr, "Cannot allocate dimension, '%s.%s' is written as is\n", csv_chart, id);
+			return;
+		}
+		d->has_last = 0;
+	}
+
+	d->algorithm = alg;
+	d->multiplier = multiplier;
+	d->divisor = divisor ? divisor : 1;
+}
+
+/* Rows are written for the seconds with lines only, the counters do not
+ * change in between, so the change since the previous row is the change of
+ * its second. A value smaller than the previous one is taken as a reset of
+ * the counter, it starts again like the first value. */
+static
+void
+csv_scale(struct csv_set * set) {
+	struct csv_dimension * d = set->dimension;
+
+	set->valid = 1;
+	if (d == NULL) {
+		set->scaled = set->value;
+		return;
+	}
+
+	switch (d->algorithm) {
+	case ND_ALG_INCREMENTAL:
+	case ND_ALG_PERCENTAGE_OF_INCREMENTAL_ROW:
+		set->valid = d->has_last && set->value >= d->last;
+		if (set->valid)
+			set->scaled = set->value - d->last;
+		d->last = set->value;
+		d->has_last = 1;
+		break;
+	default:
+		set->scaled = set->value;
+	}
+
+	set->scaled = set->scaled * d->multiplier / d->divisor;
+}
+
+static
+int
+csv_is_percentage(const struct csv_set * set) {
+	return set->dimension && (set->dimension->algorithm == ND_ALG_PERCENTAGE_OF_ABSOLUTE_ROW
+		|| set->dimension->algorithm == ND_ALG_PERCENTAGE_OF_INCREMENTAL_ROW);
+}
+
+static
+void
+csv_end() {
+	struct csv_set * set;
+	double total = 0;
+	size_t i;
+
+	for (i = 0; i < csv_row.len; i++) {
+		set = vector_item(&csv_row, i);
+		csv_scale(set);
+		if (set->valid && csv_is_percentage(set))
+			total += set->scaled;
+	}
+
+	for (i = 0; i < csv_row.len; i++) {
+		set = vector_item(&csv_row, i);
+		if (!set->valid)
+			continue;
+		if (csv_is_percentage(set))
+			set->scaled = total ? set->scaled * 100 / total : 0;
+		printf("%ld,%s,%s,%.15g\n", csv_time, csv_chart, set->id, set->scaled);
+	}
+
+	csv_row.len = 0;
+}
+
+static
+void
+csv_add(const char * id, const long value) {
+	struct csv_set set;
+
+	if (!vector_is_init(&csv_row) && vector_init(&csv_row, sizeof set) != ND_SUCCESS) {
+		fprintf(stderr, "Cannot allocate row of '%s'\n", csv_chart);
+		return;
+	}
+
+	snprintf(set.id, sizeof set.id, "%s", id);
+	set.value = value;
+	set.dimension = table_is_init(&csv_dimensions) ? table_find(&csv_dimensions, csv_key(id)) : NULL;
+	if (vector_add(&csv_row, &set) != ND_SUCCESS)
+		fprintf(stderr, "Cannot allocate row of '%s'\n", csv_chart);
+}
+
 void
 nd_chart(const char * type, const char * prefix, const char * id, const char * name,
 		const char * title, const char * units, const char * family, const char * context,
 		enum nd_charttype chart_type) {
+	if (csv_time >= 0) {
+		csv_set_chart(type, prefix, id);
+		return;
+	}
+
 	fputs("\nCHART ", stdout);
 	print_type_prefix_id(type, prefix, id);
 	printf(" '%s' '%s' '%s' '%s' '%s' %s\n",
@@ -49,16 +224,26 @@ nd_chart(const char * type, const char * prefix, const char * id, const char * n
 
 void
 nd_disable() {
+	if (csv_time >= 0)
+		return;
+
 	puts("DISABLE");
 }
 
 void
 nd_dimension(const char * id, const char * name, enum nd_algorithm alg,
 		int multiplier, int divisor, enum nd_visibility visibility) {
+	if (csv_time >= 0) {
+		csv_dimension(id, alg, multiplier, divisor);
+		return;
+	}
+
 	printf("DIMENSION %s '%s' %s %d %d",
 		id, check_null(name), nd_algorithm_str[alg], multiplier, divisor);
 	if (visibility == ND_HIDDEN) {
 		fputs(" hidden", stdout);
+	} else if (visibility == ND_OBSOLETE) {
+		fputs(" obsolete", stdout);
 	}
 	putchar('\n');
 }
@@ -70,6 +255,11 @@ nd_begin(const char * type, const char * prefix, const char * id) {
 
 void
 nd_begin_time(const char * type, const char * prefix, const char * id, const unsigned long time) {
+	if (csv_time >= 0) {
+		csv_set_chart(type, prefix, id);
+		return;
+	}
+
 	fputs("\nBEGIN ", stdout);
 	print_type_prefix_id(type, prefix, id);
 
@@ -85,10 +275,20 @@ nd_begin_time(const char * type, const char * prefix, const char * id, const uns
 
 void
 nd_end() {
+	if (csv_time >= 0) {
+		csv_end();
+		return;
+	}
+
 	puts("END");
 }
 
 void
 nd_set(const char * name, const long value) {
+	if (csv_time >= 0) {
+		csv_add(name, value);
+		return;
+	}
+
 	printf("SET %s = %ld\n", name, value);
 }
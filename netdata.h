@@ -3,6 +3,7 @@
 enum nd_visibility {
 	ND_VISIBLE = 0,
 	ND_HIDDEN,
+	ND_OBSOLETE,
 };
 
 enum nd_algorithm {
@@ -19,6 +20,7 @@ enum nd_charttype {
 };
 
 void nd_disable();
+void nd_csv(const long);
 
 void nd_chart(
 	const char * type,
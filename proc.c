@@ -0,0 +1,264 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "err.h"
+#include "proc.h"
+
+static int proc_dir = -1;
+
+static
+int
+open_proc_dir() {
+	if (proc_dir == -1)
+		proc_dir = open("/proc", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	return proc_dir;
+}
+
+/* Fields of /proc/<pid>/stat are counted from 1, the second one is the
+ * command in parentheses which may contain spaces. */
+static
+enum nd_err
+parse_stat(const char * buf, struct proc_usage * usage) {
+	unsigned long long utime = 0, stime = 0, cutime = 0, cstime = 0;
+	const char * ptr;
+	char * end;
+	int field;
+
+	ptr = strrchr(buf, ')');
+	if (ptr == NULL)
+		return ND_FILE;
+
+	for (field = 2; *ptr && field < 20; ) {
+		if (*ptr++ != ' ')
+			continue;
+		field++;
+		switch (field) {
+		case 14: utime = strtoull(ptr, &end, 10); break;
+		case 15: stime = strtoull(ptr, &end, 10); break;
+		case 16: cutime = strtoull(ptr, &end, 10); break;
+		case 17: cstime = strtoull(ptr, &end, 10); break;
+		case 20: usage->threads = strtol(ptr, &end, 10); break;
+		}
+	}
+
+	if (field < 20)
+		return ND_FILE;
+
+	usage->cpu = utime + stime;
+	usage->cpu_children = cutime + cstime;
+	return ND_SUCCESS;
+}
+
+static
+enum nd_err
+pread_stat(const int stat, const int statm, struct proc_usage * usage) {
+	char buf[BUFSIZ];
+	ssize_t ret;
+	char * ptr;
+
+	ret = pread(stat, buf, sizeof buf - 1, 0);
+	if (ret <= 0)
+		return ND_FILE;
+	buf[ret] = '\0';
+
+	if (parse_stat(buf, usage) != ND_SUCCESS)
+		return ND_FILE;
+
+	ret = pread(statm, buf, sizeof buf - 1, 0);
+	if (ret <= 0)
+		return ND_FILE;
+	buf[ret] = '\0';
+
+	/* size resident shared ... */
+	ptr = strchr(buf, ' ');
+	usage->rss = ptr ? strtol(ptr + 1, NULL, 10) : 0;
+
+	return ND_SUCCESS;
+}
+
+static
+long
+count_fds(DIR * dir) {
+	struct dirent * de;
+	long ret = 0;
+
+	rewinddir(dir);
+	while ((de = readdir(dir)))
+		if (de->d_name[0] != '.')
+			ret++;
+
+	return ret;
+}
+
+enum nd_err
+proc_open(struct proc_fds * p, const pid_t pid) {
+	char name[32];
+	int fd;
+
+	proc_close(p);
+
+	if (open_proc_dir() == -1)
+		return ND_FILE;
+
+	sprintf(name, "%d", (int)pid);
+	p->dir = openat(proc_dir, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (p->dir == -1)
+		return ND_FILE;
+
+	p->pid = pid;
+	p->stat = openat(p->dir, "stat", O_RDONLY | O_CLOEXEC);
+	p->statm = openat(p->dir, "statm", O_RDONLY | O_CLOEXEC);
+
+	/* fd directory is readable by the owner or with CAP_DAC_READ_SEARCH */
+	fd = openat(p->dir, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd != -1 && (p->fd = fdopendir(fd)) == NULL)
+		close(fd);
+
+	if (p->stat == -1 || p->statm == -1) {
+		proc_close(p);
+		return ND_FILE;
+	}
+
+	return ND_SUCCESS;
+}
+
+/* Reading fails with ESRCH once the process is gone, even if its pid was
+ * reused in the meantime. */
+enum nd_err
+proc_read(struct proc_fds * p, struct proc_usage * usage) {
+	if (p->stat == -1)
+		return ND_FILE;
+
+	if (pread_stat(p->stat, p->statm, usage) != ND_SUCCESS)
+		return ND_FILE;
+
+	usage->fds = p->fd ? count_fds(p->fd) : 0;
+	return ND_SUCCESS;
+}
+
+void
+proc_close(struct proc_fds * p) {
+	if (p->dir != -1)
+		close(p->dir);
+	if (p->stat != -1)
+		close(p->stat);
+	if (p->statm != -1)
+		close(p->statm);
+	if (p->fd)
+		closedir(p->fd);
+	p->pid = 0;
+	p->dir = -1;
+	p->stat = -1;
+	p->statm = -1;
+	p->fd = NULL;
+}
+
+/* One shot read of a short living process, e.g. a child of tcpserver. */
+enum nd_err
+proc_read_pid(const pid_t pid, struct proc_usage * usage) {
+	struct proc_fds p = PROC_FDS_EMPTY;
+	enum nd_err ret;
+
+	if ((ret = proc_open(&p, pid)) == ND_SUCCESS)
+		ret = proc_read(&p, usage);
+	proc_close(&p);
+
+	return ret;
+}
+
+/* Reads a small file of /proc/<pid>, e.g. comm or cmdline. It returns the
+ * number of bytes read, the content is not terminated. */
+ssize_t
+proc_read_file(const pid_t pid, const char * name, char * buf, const size_t size) {
+	char path[PATH_MAX];
+	ssize_t ret;
+	int fd;
+
+	if (open_proc_dir() == -1)
+		return -1;
+
+	snprintf(path, sizeof path, "%d/%s", (int)pid, name);
+	fd = openat(proc_dir, path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	ret = read(fd, buf, size);
+	close(fd);
+	return ret;
+}
+
+/* Children of all threads are listed in /proc/<pid>/task/<tid>/children. It
+ * returns the number of children, at most max of them are stored. */
+int
+proc_children(const pid_t pid, pid_t * children, const int max) {
+	char path[PATH_MAX];
+	char buf[BUFSIZ];
+	struct dirent * de;
+	const char * ptr;
+	char * end;
+	DIR * tasks;
+	ssize_t len, got;
+	long child;
+	int ret = 0;
+	int fd;
+
+	if (open_proc_dir() == -1)
+		return -1;
+
+	sprintf(path, "%d/task", (int)pid);
+	fd = openat(proc_dir, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1 || (tasks = fdopendir(fd)) == NULL) {
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	while ((de = readdir(tasks))) {
+		if (de->d_name[0] == '.')
+			continue;
+
+		sprintf(path, "%d/task/%s/children", (int)pid, de->d_name);
+		fd = openat(proc_dir, path, O_RDONLY | O_CLOEXEC);
+		if (fd == -1)
+			continue;
+
+		/* The list is read in chunks, a pid split by the chunk boundary
+		 * is moved to the beginning of the buffer. */
+		len = 0;
+		while ((got = read(fd, buf + len, sizeof buf - 1 - len)) > 0) {
+			len += got;
+			buf[len] = '\0';
+			for (ptr = buf; ; ptr = end) {
+				child = strtol(ptr, &end, 10);
+				if (end == ptr || *end == '\0')
+					break;
+				if (ret < max)
+					children[ret] = child;
+				ret++;
+			}
+			len = strlen(ptr);
+			memmove(buf, ptr, len + 1);
+		}
+		if (len > 0) {
+			child = strtol(buf, &end, 10);
+			if (end != buf) {
+				if (ret < max)
+					children[ret] = child;
+				ret++;
+			}
+		}
+		close(fd);
+	}
+
+	closedir(tasks);
+	return ret;
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+struct proc_usage {
+	unsigned long long cpu;          /* utime + stime in clock ticks */
+	unsigned long long cpu_children; /* cutime + cstime of waited for children */
+	long rss;                        /* resident set size in pages */
+	long threads;
+	long fds;
+};
+
+/* Descriptors of /proc/<pid> kept open between reads. The files are read by
+ * pread(), so every tick costs a few syscalls without any path lookup. */
+struct proc_fds {
+	pid_t pid;
+	int dir;
+	int stat;
+	int statm;
+	DIR * fd;
+};
+
+#define PROC_FDS_EMPTY { .pid = 0, .dir = -1, .stat = -1, .statm = -1, .fd = NULL }
+
+enum nd_err proc_open(struct proc_fds *, const pid_t);
+enum nd_err proc_read(struct proc_fds *, struct proc_usage *);
+void proc_close(struct proc_fds *);
+
+enum nd_err proc_read_pid(const pid_t, struct proc_usage *);
+ssize_t proc_read_file(const pid_t, const char *, char *, const size_t);
+int proc_children(const pid_t, pid_t *, const int);
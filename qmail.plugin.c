@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,9 +22,11 @@
 #include "vector.h"
 
 #include "fs.h"
+#include "backfill.h"
 #include "queue.h"
 #include "send.h"
 #include "smtp.h"
+#include "tcpserver.h"
 
 #define DEFAULT_PATH "/var/log/qmail"
 
@@ -39,7 +42,7 @@ enum poll {
 static
 void
 usage(const char * name) {
-	fprintf(stderr, "usage: %s <timout> [path]\n", name);
+	fprintf(stderr, "usage: %s <timout> [path]\n       %s --backfill [path]\n", name, name);
 }
 
 static
@@ -49,14 +52,21 @@ prepare_watcher(struct fs_watch * watch, const int fd, const struct stat_func *
 
 	watch->file_name = "current";
 	watch->type = WATCH_LOG_FILE;
-	sprintf(file_name, "%s/%s", watch->dir_name, watch->file_name);
-	watch->watch_dir = inotify_add_watch(fd, watch->dir_name, IN_CREATE);
-	if (watch->watch_dir == -1) {
-		perror("inotify_add_watch");
-		return ND_INOTIFY;
+	watch->watch_dir = -1;
+	watch->fd = -1;
+
+	/* Backfill reads the files by itself, it passes no inotify descriptor */
+	if (fd != -1) {
+		sprintf(file_name, "%s/%s", watch->dir_name, watch->file_name);
+		watch->watch_dir = inotify_add_watch(fd, watch->dir_name, IN_CREATE);
+		if (watch->watch_dir == -1) {
+			perror("inotify_add_watch");
+			return ND_INOTIFY;
+		}
+		watch->fd = open(file_name, O_RDONLY);
+		lseek(watch->fd, 0, SEEK_END);
+		watch->record_times = 1;
 	}
-	watch->fd = open(file_name, O_RDONLY);
-	lseek(watch->fd, 0, SEEK_END);
 	watch->func = func;
 	watch->data = func->init();
 	if (watch->data == NULL) {
@@ -68,14 +78,14 @@ prepare_watcher(struct fs_watch * watch, const int fd, const struct stat_func *
 
 static
 enum nd_err
-append_queue_watcher(struct vector * v) {
+append_polled_watcher(struct vector * v, const enum watch_type type, const struct stat_func * func) {
 	struct fs_watch watch;
 
 	memset(&watch, 0, sizeof watch);
-	watch.type = WATCH_QUEUE;
+	watch.type = type;
 	watch.watch_dir = -1;
 	watch.fd = -1;
-	watch.func = queue_func;
+	watch.func = func;
 	watch.data = watch.func->init();
 
 	if (watch.data == NULL) {
@@ -139,6 +149,7 @@ main(int argc, const char * argv[]) {
 	struct fs_watch * watch;
 	const char * argv0;
 	const char * path;
+	int backfilling = 0;
 	int timeout = 1;
 	int fs_event_fd;
 	int signal_fd;
@@ -149,7 +160,10 @@ main(int argc, const char * argv[]) {
 	path = DEFAULT_PATH;
 	argv0 = *argv; argv++; argc--;
 
-	if (argc > 0) {
+	if (argc > 0 && !strcmp(*argv, "--backfill")) {
+		backfilling = 1;
+		argv++; argc--;
+	} else if (argc > 0) {
 		timeout = atoi(*argv);
 		argv++; argc--;
 	} else
@@ -167,6 +181,15 @@ main(int argc, const char * argv[]) {
 
 	vector_init(&vector, sizeof * watch);
 
+	if (backfilling) {
+		detect_log_dirs(-1, &vector);
+		if (vector_is_empty(&vector)) {
+			fprintf(stderr, "Nothing to backfill for qmail\n");
+			exit(1);
+		}
+		exit(backfill(vector.data, vector.len) != ND_SUCCESS);
+	}
+
 	timer_fd = prepare_timer_fd(timeout);
 	pfd[POLL_TIMER].fd = timer_fd;
 	pfd[POLL_TIMER].events = POLLIN;
@@ -180,7 +203,8 @@ main(int argc, const char * argv[]) {
 	pfd[POLL_FS_EVENT].events = POLLIN;
 
 	detect_log_dirs(fs_event_fd, &vector);
-	append_queue_watcher(&vector);
+	append_polled_watcher(&vector, WATCH_QUEUE, queue_func);
+	append_polled_watcher(&vector, WATCH_PROC, tcpserver_func);
 
 	if (vector_is_empty(&vector)) {
 		fprintf(stderr, "Nothing to log for qmail\n");
@@ -190,6 +214,8 @@ main(int argc, const char * argv[]) {
 	for (i = 0; i < vector.len; i++) {
 		watch = vector_item(&vector, i);
 		watch->func->print_hdr(watch->dir_name);
+		if (watch->type == WATCH_LOG_FILE)
+			print_lag_hdr(watch, "qmail");
 		clock_gettime(CLOCK_REALTIME, &watch->time);
 	}
 
@@ -223,7 +249,7 @@ main(int argc, const char * argv[]) {
 
 					if (watch->type == WATCH_LOG_FILE)
 						read_log_file(watch);
-					else if (watch->type == WATCH_QUEUE)
+					else if (watch->type == WATCH_QUEUE || watch->type == WATCH_PROC)
 						watch->func->process(NULL, watch->data);
 
 					if (watch->func->postprocess)
@@ -236,6 +262,9 @@ main(int argc, const char * argv[]) {
 						break;
 					}
 					watch->func->clear(watch->data);
+
+					if (watch->type == WATCH_LOG_FILE)
+						print_lag(watch, "qmail", last_update);
 				}
 
 				last_update = update_timestamp(&ratelimitspp_time);
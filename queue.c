@@ -1,25 +1,149 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 
+#include <ctype.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "callbacks.h"
+#include "env.h"
 #include "err.h"
 #include "fs.h"
+#include "hash.h"
 #include "netdata.h"
+#include "table.h"
+#include "topn.h"
 #include "queue.h"
 
 #define QMAIL_QUEUE_PATH "/var/qmail/queue/"
 
+/* Number of remote/N/M files parsed per tick and number of domains shown.
+ * Both can be changed by environment variables. */
+#define DEFAULT_PARSE_RATE 1000
+#define DEFAULT_TOP_DOMAINS 10
+#define MAX_TOP_DOMAINS 100
+
+/* Upper bounds of the cache, messages and domains above them are not tracked. */
+#define MAX_MESSAGES (1 << 20)
+#define MAX_DOMAINS  (1 << 16)
+
+/* Most messages have recipients in one or two domains. Recipients in further
+ * domains are accounted as "other" to keep the cache entry small. */
+#define MESSAGE_DOMAINS 2
+
+#define DOMAIN_NAME_MAX 256
+
+/* Number of samples used for the queue trend and the size of mess whose
+ * reaching is predicted. */
+#define DEFAULT_TREND_WINDOW 60
+#define MAX_TREND_WINDOW 3600
+#define DEFAULT_THRESHOLD 1000
+
+/* Netdata collects integer values only. We have to multiply collected value by
+ * this constant and set the DIMENSION divider to the same value if we need
+ * fractional values.  */
+#define FRACTIONAL_CONVERSION 100
+
+struct queue_message {
+	uint32_t generation; /* scan in which the message was seen the last time */
+	uint16_t split;      /* remote/N subdirectory */
+	uint16_t parsed;
+	uint32_t count[MESSAGE_DOMAINS];
+	uint32_t other;
+	uint64_t domain[MESSAGE_DOMAINS];
+};
+
+struct queue_domain {
+	long pending;
+	char name[DOMAIN_NAME_MAX];
+};
+
+struct queue_remote {
+	struct table messages; /* inode number -> struct queue_message */
+	struct table domains;  /* hash of domain -> struct queue_domain */
+	struct topn top;
+	uint32_t generation;
+	long other;
+	int parse_rate;
+	int hdr_printed;
+	long parsed;
+};
+
+struct queue_sample {
+	long mess;
+	long delta; /* change of mess since the previous sample */
+	long dt;    /* milliseconds since the previous sample */
+};
+
+/* Rolling window of mess counts. Sums are updated when a sample enters and
+ * leaves the window, so every tick costs O(1) regardless of the window size.
+ * Samples are indexed by an absolute tick number, which keeps the least
+ * squares sums exact in integers. */
+struct queue_trend {
+	size_t cap;
+	size_t len;
+	struct queue_sample * samples;
+	uint64_t tick;      /* absolute index of the next sample */
+	int64_t sum;        /* sum of mess */
+	int64_t sum_tick;   /* sum of tick * mess */
+	int64_t inject;     /* sum of positive deltas */
+	int64_t drain;      /* sum of negative deltas */
+	int64_t dt;         /* sum of dt */
+	int64_t intervals;  /* samples with a dt, the first one has none */
+	struct timespec last;
+	long threshold;
+};
+
 struct queue_statistics {
 	int mess;
 	int todo;
+	struct queue_remote * remote;
+	struct queue_trend trend;
+
+	long inject_rate;
+	long drain_rate;
+	long growth;
+	long eta;           /* -1 if mess is not growing */
 };
 
+static
+struct queue_remote *
+queue_remote_init() {
+	struct queue_remote * ret;
+	DIR * dir;
+
+	/* The remote queue is readable by qmails only. The domain chart is
+	 * silently skipped if the plugin has no access. */
+	dir = opendir(QMAIL_QUEUE_PATH "remote");
+	if (dir == NULL) {
+		fprintf(stderr, "Cannot open dir: %s, domains are not collected\n", QMAIL_QUEUE_PATH "remote");
+		return NULL;
+	}
+	closedir(dir);
+
+	ret = calloc(1, sizeof * ret);
+	if (ret == NULL)
+		return NULL;
+
+	ret->parse_rate = env_int("QMAIL_QUEUE_PARSE_RATE", DEFAULT_PARSE_RATE, 1, INT_MAX);
+	if (table_init(&ret->messages, sizeof(struct queue_message)) != ND_SUCCESS
+			|| table_init(&ret->domains, sizeof(struct queue_domain)) != ND_SUCCESS
+			|| topn_init(&ret->top, env_int("QMAIL_QUEUE_DOMAINS", DEFAULT_TOP_DOMAINS, 1, MAX_TOP_DOMAINS)) != ND_SUCCESS) {
+		table_free(&ret->messages);
+		table_free(&ret->domains);
+		free(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
 static
 void *
 queue_data_init() {
@@ -34,9 +158,34 @@ queue_data_init() {
 	}
 
 	ret = calloc(1, sizeof * ret);
+	if (ret == NULL)
+		return NULL;
+
+	ret->trend.cap = env_int("QMAIL_QUEUE_TREND_WINDOW", DEFAULT_TREND_WINDOW, 2, MAX_TREND_WINDOW);
+	ret->trend.threshold = env_int("QMAIL_QUEUE_THRESHOLD", DEFAULT_THRESHOLD, 1, INT_MAX);
+	ret->trend.samples = calloc(ret->trend.cap, sizeof * ret->trend.samples);
+	if (ret->trend.samples == NULL) {
+		free(ret);
+		return NULL;
+	}
+
+	ret->remote = queue_remote_init();
 	return ret;
 }
 
+static
+void
+queue_data_fini(struct queue_statistics * data) {
+	if (data->remote) {
+		table_free(&data->remote->messages);
+		table_free(&data->remote->domains);
+		topn_free(&data->remote->top);
+		free(data->remote);
+	}
+	free(data->trend.samples);
+	free(data);
+}
+
 static
 int
 print_queue_hdr(const char * name) {
@@ -44,9 +193,40 @@ print_queue_hdr(const char * name) {
 	nd_dimension("mess", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
 	nd_dimension("todo", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
 
+	nd_chart("qmail", "queue", "growth", "", "Qmail queue growth", "messages/s",
+		"queue", "qmail.queue_growth", ND_CHART_TYPE_LINE);
+	nd_dimension("inject", NULL, ND_ALG_ABSOLUTE, 1, FRACTIONAL_CONVERSION, ND_VISIBLE);
+	nd_dimension("drain", NULL, ND_ALG_ABSOLUTE, -1, FRACTIONAL_CONVERSION, ND_VISIBLE);
+	nd_dimension("slope", NULL, ND_ALG_ABSOLUTE, 1, FRACTIONAL_CONVERSION, ND_VISIBLE);
+
+	nd_chart("qmail", "queue", "eta", "", "Qmail queue estimated time to reach the threshold",
+		"seconds", "queue", "qmail.queue_eta", ND_CHART_TYPE_LINE);
+	nd_dimension("eta", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+
 	return fflush(stdout);
 }
 
+static
+void
+print_queue_domains(struct queue_remote * remote, const unsigned long time) {
+	/* The header is known only once the remote queue is accessible. */
+	if (!remote->hdr_printed) {
+		nd_chart("qmail", "queue", "domains_scan", "", "Qmail remote queue messages parsed for domains",
+			"messages", "queue", "qmail.queue_domains_scan", ND_CHART_TYPE_STACKED);
+		nd_dimension("parsed", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		nd_dimension("unparsed", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		remote->hdr_printed = 1;
+	}
+
+	topn_print(&remote->top, "qmail", "queue", "domains", "Qmail remote queue recipients by domain",
+		"recipients", "queue", "qmail.queue_domains", time);
+
+	nd_begin_time("qmail", "queue", "domains_scan", time);
+	nd_set("parsed", remote->parsed);
+	nd_set("unparsed", remote->messages.len - remote->parsed);
+	nd_end();
+}
+
 static
 int
 print_queue_data(const char * name, const struct queue_statistics * data, const unsigned long time) {
@@ -55,6 +235,21 @@ print_queue_data(const char * name, const struct queue_statistics * data, const
 	nd_set("todo", data->todo);
 	nd_end();
 
+	nd_begin_time("qmail", "queue", "growth", time);
+	nd_set("inject", data->inject_rate);
+	nd_set("drain", data->drain_rate);
+	nd_set("slope", data->growth);
+	nd_end();
+
+	/* The value is left empty while the queue is not growing. */
+	nd_begin_time("qmail", "queue", "eta", time);
+	if (data->eta >= 0)
+		nd_set("eta", data->eta);
+	nd_end();
+
+	if (data->remote)
+		print_queue_domains(data->remote, time);
+
 	return fflush(stdout);
 }
 
@@ -96,28 +291,323 @@ measure_dir(const char * name) {
 	return res;
 }
 
+/* Returns zero if the domain is not tracked because the table is full. */
+static
+int
+account_domain(struct queue_remote * remote, const uint64_t key, const char * name, const long count) {
+	struct queue_domain * domain;
+
+	domain = table_find(&remote->domains, key);
+	if (domain == NULL && count > 0 && remote->domains.len < MAX_DOMAINS) {
+		domain = table_insert(&remote->domains, key);
+		if (domain)
+			strcpy(domain->name, name);
+	}
+
+	if (domain == NULL)
+		return 0;
+
+	domain->pending += count;
+	if (domain->pending <= 0)
+		table_remove(&remote->domains, key);
+
+	return 1;
+}
+
+static
+void
+add_recipient(struct queue_remote * remote, struct queue_message * msg, const char * domain, const size_t len) {
+	uint64_t key;
+	int i;
+
+	if (len > 0) {
+		key = hash_mem(domain, len);
+		for (i = 0; i < MESSAGE_DOMAINS; i++) {
+			if (msg->count[i] == 0 || msg->domain[i] == key) {
+				if (!account_domain(remote, key, domain, 1))
+					break;
+				msg->domain[i] = key;
+				msg->count[i]++;
+				return;
+			}
+		}
+	}
+
+	msg->other++;
+	remote->other++;
+}
+
+/* The remote file holds recipients as a sequence of "T<address>\0" items. The
+ * 'T' is rewritten to 'D' by qmail-send once the delivery is done. The file is
+ * parsed only once, so recipients delivered later are still accounted until
+ * the whole message leaves the queue. */
+static
+void
+parse_message(struct queue_remote * remote, const uint64_t inode, struct queue_message * msg) {
+	char domain[DOMAIN_NAME_MAX];
+	char path[PATH_MAX];
+	char buf[BUFSIZ];
+	int pending = 0;
+	int start = 1;
+	size_t len = 0;
+	ssize_t ret, i;
+	int fd;
+
+	msg->parsed = 1;
+	remote->parsed++;
+
+	sprintf(path, QMAIL_QUEUE_PATH "remote/%u/%llu", msg->split, (unsigned long long)inode);
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return;
+
+	while ((ret = read(fd, buf, sizeof buf)) > 0) {
+		for (i = 0; i < ret; i++) {
+			if (start) {
+				pending = buf[i] == 'T';
+				start = 0;
+				len = 0;
+			} else if (buf[i] == '\0') {
+				if (pending) {
+					domain[len] = '\0';
+					add_recipient(remote, msg, domain, len);
+				}
+				start = 1;
+			} else if (buf[i] == '@') {
+				len = 0;
+			} else if (len < sizeof domain - 1) {
+				domain[len++] = tolower((unsigned char)buf[i]);
+			}
+		}
+	}
+
+	close(fd);
+}
+
+static
+void
+forget_message(struct queue_remote * remote, struct queue_message * msg) {
+	int i;
+
+	for (i = 0; i < MESSAGE_DOMAINS; i++)
+		if (msg->count[i])
+			account_domain(remote, msg->domain[i], NULL, -(long)msg->count[i]);
+
+	remote->other -= msg->other;
+	if (msg->parsed)
+		remote->parsed--;
+}
+
+static
+void
+scan_remote_split(struct queue_remote * remote, const char * name) {
+	struct queue_message * msg;
+	char path[PATH_MAX];
+	struct dirent * de;
+	uint64_t inode;
+	char * end;
+	DIR * dir;
+
+	sprintf(path, QMAIL_QUEUE_PATH "remote/%s", name);
+	dir = opendir(path);
+	if (dir == NULL)
+		return;
+
+	while ((de = readdir(dir))) {
+		inode = strtoull(de->d_name, &end, 10);
+		if (*end != '\0' || inode == 0)
+			continue;
+
+		msg = table_find(&remote->messages, inode);
+		if (msg == NULL) {
+			if (remote->messages.len >= MAX_MESSAGES)
+				continue;
+			msg = table_insert(&remote->messages, inode);
+			if (msg == NULL)
+				continue;
+			msg->split = atoi(name);
+		}
+		msg->generation = remote->generation;
+	}
+
+	closedir(dir);
+}
+
+/* Each tick the file names in remote/N are listed, which is as cheap as
+ * counting of mess. Files of new messages are parsed in the background, at
+ * most parse_rate of them per tick, so the I/O stays bounded even for a huge
+ * queue. Messages which left the queue are dropped from the cache. */
+static
+void
+measure_remote(struct queue_remote * remote) {
+	struct queue_message * msg;
+	struct dirent * de;
+	int budget;
+	size_t i;
+	DIR * dir;
+
+	dir = opendir(QMAIL_QUEUE_PATH "remote");
+	if (dir == NULL)
+		return;
+
+	remote->generation++;
+	while ((de = readdir(dir)))
+		if (de->d_name[0] != '.')
+			scan_remote_split(remote, de->d_name);
+	closedir(dir);
+
+	budget = remote->parse_rate;
+	for (i = 0; i < remote->messages.cap;) {
+		if (!remote->messages.keys[i]) {
+			i++;
+			continue;
+		}
+
+		msg = table_item(&remote->messages, i);
+		if (msg->generation != remote->generation) {
+			forget_message(remote, msg);
+			table_remove_at(&remote->messages, i);
+			continue;
+		}
+
+		if (!msg->parsed && budget > 0) {
+			parse_message(remote, remote->messages.keys[i], msg);
+			budget--;
+		}
+		i++;
+	}
+}
+
+static
+void
+rank_domains(struct queue_remote * remote) {
+	struct queue_domain * domain;
+	size_t i;
+
+	topn_clear(&remote->top);
+	for (i = 0; i < remote->domains.cap; i++) {
+		if (remote->domains.keys[i]) {
+			domain = table_item(&remote->domains, i);
+			topn_offer(&remote->top, domain->name, strlen(domain->name), domain->pending);
+		}
+	}
+	if (remote->other)
+		topn_offer(&remote->top, "other", sizeof "other" - 1, remote->other);
+	topn_update(&remote->top);
+}
+
+static
+void
+trend_add(struct queue_trend * trend, const long mess) {
+	struct queue_sample * sample;
+	struct timespec now;
+	uint64_t oldest;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (trend->len == trend->cap) {
+		oldest = trend->tick - trend->len;
+		sample = trend->samples + oldest % trend->cap;
+		trend->sum -= sample->mess;
+		trend->sum_tick -= (int64_t)oldest * sample->mess;
+		trend->inject -= sample->delta > 0 ? sample->delta : 0;
+		trend->drain -= sample->delta < 0 ? -sample->delta : 0;
+		trend->dt -= sample->dt;
+		trend->intervals -= oldest ? 1 : 0;
+		trend->len--;
+	}
+
+	sample = trend->samples + trend->tick % trend->cap;
+	sample->mess = mess;
+	if (trend->tick) {
+		sample->delta = mess - trend->samples[(trend->tick - 1) % trend->cap].mess;
+		sample->dt = (now.tv_sec - trend->last.tv_sec) * 1000
+			+ (now.tv_nsec - trend->last.tv_nsec) / 1000000;
+	} else {
+		sample->delta = 0;
+		sample->dt = 0;
+	}
+	trend->last = now;
+
+	trend->sum += sample->mess;
+	trend->sum_tick += (int64_t)trend->tick * sample->mess;
+	trend->inject += sample->delta > 0 ? sample->delta : 0;
+	trend->drain += sample->delta < 0 ? -sample->delta : 0;
+	trend->dt += sample->dt;
+	trend->intervals += trend->tick ? 1 : 0;
+	trend->len++;
+	trend->tick++;
+}
+
+/* The inject and drain rates are sums of increases and decreases of mess over
+ * the window. A message injected and delivered within one tick is not seen.
+ * The growth is the slope of the least squares line fitted to the window:
+ *
+ *   slope = sum((x - avg(x)) * y) / sum((x - avg(x))^2)
+ *
+ * For consecutive ticks a..b the denominator is n * (n^2 - 1) / 12. */
+static
+void
+postprocess_queue(struct queue_statistics * data) {
+	struct queue_trend * trend = &data->trend;
+	int64_t first, last, n;
+	double slope;
+
+	if (data->remote)
+		rank_domains(data->remote);
+
+	trend_add(trend, data->mess);
+
+	data->eta = -1;
+	n = trend->len;
+	if (n < 2 || trend->dt <= 0) {
+		data->inject_rate = 0;
+		data->drain_rate = 0;
+		data->growth = 0;
+		return;
+	}
+
+	data->inject_rate = trend->inject * 1000 * FRACTIONAL_CONVERSION / trend->dt;
+	data->drain_rate = trend->drain * 1000 * FRACTIONAL_CONVERSION / trend->dt;
+
+	first = trend->tick - n;
+	last = trend->tick - 1;
+	slope = (double)(2 * trend->sum_tick - (first + last) * trend->sum) * 6 / (n * (n * n - 1));
+	/* Per tick to per second, the average tick length comes from the window. */
+	slope = slope * trend->intervals * 1000 / trend->dt;
+	data->growth = slope * FRACTIONAL_CONVERSION;
+
+	if (data->mess >= trend->threshold)
+		data->eta = 0;
+	else if (slope > 0)
+		data->eta = (trend->threshold - data->mess) / slope;
+}
+
 static
 void
 measure_queue(const char * unused, struct queue_statistics * data) {
 	data->mess = measure_dir(QMAIL_QUEUE_PATH "mess");
 	data->todo = measure_dir(QMAIL_QUEUE_PATH "todo");
+	if (data->remote)
+		measure_remote(data->remote);
 }
 
 static
 void
 clear_data(struct queue_statistics * data) {
-	memset(data, 0, sizeof * data);
+	data->mess = 0;
+	data->todo = 0;
 }
 
 static
 struct stat_func queue = {
 	.init = &queue_data_init,
-	.fini = &free,
+	.fini = (void (*)(void *))&queue_data_fini,
 
 	.print_hdr   = &print_queue_hdr,
 	.print       = (int (*)(const char *, const void *, unsigned long))&print_queue_data,
 	.process     = (void (*)(const char *, void *))&measure_queue,
-	.postprocess = NULL,
+	.postprocess = (void (*)(void *))&postprocess_queue,
 	.clear       = (void (*)(void *))&clear_data,
 };
 
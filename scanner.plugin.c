@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,6 +22,7 @@
 #include "vector.h"
 
 #include "fs.h"
+#include "backfill.h"
 #include "scanner.h"
 
 #define DEFAULT_PATH "/var/log"
@@ -37,21 +39,28 @@ enum poll {
 static
 void
 usage(const char * name) {
-	fprintf(stderr, "usage: %s <timout> [path]\n", name);
+	fprintf(stderr, "usage: %s <timout> [path]\n       %s --backfill [path]\n", name, name);
 }
 
 static
 enum nd_err
 prepare_watcher(struct fs_watch * watch, const int fd, const struct stat_func * func) {
 	char file_name[PATH_MAX];
-	sprintf(file_name, "%s/%s", watch->dir_name, watch->file_name);
-	watch->watch_dir = inotify_add_watch(fd, watch->dir_name, IN_CREATE);
-	if (watch->watch_dir == -1) {
-		perror("inotify_add_watch");
-		return ND_INOTIFY;
+	watch->watch_dir = -1;
+	watch->fd = -1;
+
+	/* Backfill reads the files by itself, it passes no inotify descriptor */
+	if (fd != -1) {
+		sprintf(file_name, "%s/%s", watch->dir_name, watch->file_name);
+		watch->watch_dir = inotify_add_watch(fd, watch->dir_name, IN_CREATE);
+		if (watch->watch_dir == -1) {
+			perror("inotify_add_watch");
+			return ND_INOTIFY;
+		}
+		watch->fd = open(file_name, O_RDONLY);
+		lseek(watch->fd, 0, SEEK_END);
+		watch->record_times = 1;
 	}
-	watch->fd = open(file_name, O_RDONLY);
-	lseek(watch->fd, 0, SEEK_END);
 	watch->func = func;
 	watch->data = func->init();
 	if (watch->data == NULL) {
@@ -105,6 +114,7 @@ main(int argc, const char * argv[]) {
 	struct fs_watch * watch;
 	const char * argv0;
 	const char * path;
+	int backfilling = 0;
 	int timeout = 1;
 	int fs_event_fd;
 	int signal_fd;
@@ -115,7 +125,10 @@ main(int argc, const char * argv[]) {
 	path = DEFAULT_PATH;
 	argv0 = *argv; argv++; argc--;
 
-	if (argc > 0) {
+	if (argc > 0 && !strcmp(*argv, "--backfill")) {
+		backfilling = 1;
+		argv++; argc--;
+	} else if (argc > 0) {
 		timeout = atoi(*argv);
 		argv++; argc--;
 	} else
@@ -133,6 +146,15 @@ main(int argc, const char * argv[]) {
 
 	vector_init(&vector, sizeof * watch);
 
+	if (backfilling) {
+		detect_log_dirs(-1, &vector);
+		if (vector_is_empty(&vector)) {
+			fprintf(stderr, "Nothing to backfill for scanner\n");
+			exit(1);
+		}
+		exit(backfill(vector.data, vector.len) != ND_SUCCESS);
+	}
+
 	timer_fd = prepare_timer_fd(timeout);
 	pfd[POLL_TIMER].fd = timer_fd;
 	pfd[POLL_TIMER].events = POLLIN;
@@ -155,6 +177,7 @@ main(int argc, const char * argv[]) {
 	for (i = 0; i < vector.len; i++) {
 		watch = vector_item(&vector, i);
 		watch->func->print_hdr(watch->dir_name);
+		print_lag_hdr(watch, "scannerd");
 		clock_gettime(CLOCK_REALTIME, &watch->time);
 	}
 
@@ -192,6 +215,8 @@ main(int argc, const char * argv[]) {
 						break;
 					}
 					watch->func->clear(watch->data);
+
+					print_lag(watch, "scannerd", last_update);
 				}
 			}
 		}
@@ -1,13 +1,166 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 
+#include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "callbacks.h"
+#include "env.h"
+#include "err.h"
+#include "hash.h"
+#include "histogram.h"
+#include "hll.h"
 #include "netdata.h"
+#include "table.h"
+#include "tai.h"
+#include "topn.h"
+#include "vector.h"
+#include "hitters.h"
+#include "timer.h"
+#include "wheel.h"
+#include "bucket.h"
 #include "send.h"
 
+/* Deliveries whose end line never comes, because qmail-send was killed or the
+ * log was lost, are dropped after DELIVERY_TIMEOUT_SLOTS slots of a minute.
+ * Messages are dropped after MESSAGE_TIMEOUT_SLOTS hours, a day more than the
+ * default queuelifetime of qmail. */
+#define DELIVERY_SLOT 60
+#define DELIVERY_TIMEOUT_SLOTS 60
+#define DELIVERY_WHEEL_SLOTS 64
+#define MESSAGE_SLOT 3600
+#define MESSAGE_TIMEOUT_SLOTS (8 * 24)
+#define MESSAGE_WHEEL_SLOTS (MESSAGE_TIMEOUT_SLOTS + 8)
+
+/* Messages tracked at most, the table then takes 64 MiB */
+#define DEFAULT_MESSAGES (1 << 20)
+#define MAX_MESSAGES (1 << 24)
+
+/* Seconds lines may come late in the event time mode */
+#define MAX_LATENESS 3600
+
+enum channel {
+	CHANNEL_LOCAL,
+	CHANNEL_REMOTE,
+	CHANNELS
+};
+
+static const char * const channel_names[CHANNELS] = {
+	[CHANNEL_LOCAL]  = "local",
+	[CHANNEL_REMOTE] = "remote",
+};
+
+struct delivery {
+	uint64_t start;              /* microseconds of UNIX time */
+	uint64_t slot;               /* slot of start in the delivery wheel */
+	uint64_t bytes;              /* size of the message, 0 if unknown */
+	enum channel channel;
+	char domain[HITTER_NAME_MAX]; /* recipient domain of remote delivery */
+};
+
+struct message {
+	uint64_t start;              /* microseconds of UNIX time */
+	uint64_t slot;               /* slot of start in the message wheel */
+	uint64_t bytes;              /* from the info msg line */
+};
+
+/* Lines of the main charts counted by their time when QMAIL_EVENT_LATENESS
+ * is set */
+enum event_field {
+	EVENT_START_DELIVERY,
+	EVENT_END_MSG,
+	EVENT_SUCCESS,
+	EVENT_FAILURE,
+	EVENT_DEFERRAL,
+	EVENT_FIELDS
+};
+
+/* Default number of counters for destinations and of charted ones */
+#define DEFAULT_DESTINATION_COUNTERS 1000
+#define DEFAULT_DESTINATIONS 10
+#define MAX_DESTINATION_COUNTERS (1 << 20)
+#define MAX_DESTINATIONS 100
+
+enum outcome {
+	OUTCOME_DEFERRAL,
+	OUTCOME_FAILURE,
+	OUTCOMES
+};
+
+static const char * const outcome_names[OUTCOMES] = {
+	[OUTCOME_DEFERRAL] = "deferral",
+	[OUTCOME_FAILURE]  = "failure",
+};
+
+enum reason {
+	REASON_CONNECTION,
+	REASON_GREETING,
+	REASON_DNS,
+	REASON_TLS,
+	REASON_SENDER,
+	REASON_RECIPIENT,
+	REASON_DATA,
+	REASON_MAILBOX,
+	REASON_QUOTA,
+	REASON_OTHER,
+	REASONS
+};
+
+static const char * const reason_names[REASONS] = {
+	[REASON_CONNECTION] = "connection",
+	[REASON_GREETING]   = "greeting",
+	[REASON_DNS]        = "dns",
+	[REASON_TLS]        = "tls",
+	[REASON_SENDER]     = "sender",
+	[REASON_RECIPIENT]  = "recipient",
+	[REASON_DATA]       = "data",
+	[REASON_MAILBOX]    = "mailbox",
+	[REASON_QUOTA]      = "quota",
+	[REASON_OTHER]      = "other",
+};
+
+/* Texts of qmail-remote and qmail-local, the first one found in the reason
+ * gives its class. */
+static const struct {
+	const char * text;
+	enum reason reason;
+} reason_texts[] = {
+	{ "TLS",                         REASON_TLS },
+	{ "_but_greeting_failed",        REASON_GREETING },
+	{ "_but_my_name_was_rejected",   REASON_GREETING },
+	{ "_but_sender_was_rejected",    REASON_SENDER },
+	{ "_does_not_like_recipient",    REASON_RECIPIENT },
+	{ "_failed_on_DATA_command",     REASON_DATA },
+	{ "_failed_after_I_sent_the_message", REASON_DATA },
+	{ "_but_connection_died",        REASON_CONNECTION },
+	{ "establish_an_SMTP_connection", REASON_CONNECTION },
+	{ "CNAME_lookup_failed",         REASON_DNS },
+	{ "couldn't_find_any_host",      REASON_DNS },
+	{ "couldn't_find_a_mail_exchanger", REASON_DNS },
+	{ "no_mailbox_here",             REASON_MAILBOX },
+	{ "quota",                       REASON_QUOTA },
+};
+
+/* Message sizes are counted in SIZE_BUCKETS buckets growing by 4 times from
+ * below 1 KiB to 16 MiB and more. */
+#define SIZE_BUCKETS 9
+
+static const char * const size_names[SIZE_BUCKETS] = {
+	"1k", "4k", "16k", "64k", "256k", "1M", "4M", "16M", "more"
+};
+
+/* Concurrency of a channel from status lines. The average is taken over the
+ * lines of the tick, a tick without one keeps the last value. */
+struct concurrency {
+	long last;
+	long limit;
+	long max;
+	long sum;
+	long samples;
+};
+
 struct send_statistics {
 	int start_delivery;
 	int end_msg;
@@ -15,27 +168,161 @@ struct send_statistics {
 	int delivery_success;
 	int delivery_failure;
 	int delivery_deferral;
+
+	struct hll_window senders;   /* distinct envelope senders */
+	struct hll_window domains;   /* distinct recipient domains */
+
+	uint64_t now;                /* time of the last line */
+
+	struct table inflight;       /* delivery id -> struct delivery */
+	struct wheel deliveries;     /* delivery ids by start */
+	long inflight_count[CHANNELS];
+	int expired;
+	struct histogram latency[CHANNELS]; /* microseconds of this tick */
+
+	struct table messages;       /* inode of message -> struct message */
+	struct wheel queued;         /* inodes by start */
+	long max_messages;
+	int messages_expired;
+	int messages_untracked;      /* new messages over max_messages */
+	struct histogram residence;  /* milliseconds of this tick */
+
+	struct concurrency concurrency[CHANNELS];
+
+	uint64_t bytes_queued;       /* total since start */
+	uint64_t bytes_delivered[CHANNELS]; /* total of successful deliveries */
+	int sizes[SIZE_BUCKETS];
+
+	int reasons[OUTCOMES][REASONS];
+	struct hitters destinations[OUTCOMES]; /* remote hosts or domains */
+	struct topn top[OUTCOMES];
+
+	int event_time;              /* main charts are fed from events */
+	struct buckets events;
 };
 
 static
 void *
 send_data_init() {
+	const int counters = env_int("QMAIL_SEND_DESTINATION_COUNTERS", DEFAULT_DESTINATION_COUNTERS, 1, MAX_DESTINATION_COUNTERS);
+	const int shown = env_int("QMAIL_SEND_DESTINATIONS", DEFAULT_DESTINATIONS, 1, MAX_DESTINATIONS);
+	const int lateness = env_int("QMAIL_EVENT_LATENESS", -1, -1, MAX_LATENESS);
 	struct send_statistics * ret;
+	int i;
 
 	ret = calloc(1, sizeof * ret);
+	if (ret == NULL)
+		return NULL;
+
+	hll_window_init(&ret->senders);
+	hll_window_init(&ret->domains);
+	ret->max_messages = env_int("QMAIL_SEND_MESSAGES", DEFAULT_MESSAGES, 0, MAX_MESSAGES);
+
+	if (table_init(&ret->inflight, sizeof(struct delivery)) != ND_SUCCESS)
+		goto err_inflight;
+	if (wheel_init(&ret->deliveries, DELIVERY_WHEEL_SLOTS, DELIVERY_SLOT * 1000000ULL, DELIVERY_TIMEOUT_SLOTS) != ND_SUCCESS)
+		goto err_deliveries;
+	if (table_init(&ret->messages, sizeof(struct message)) != ND_SUCCESS)
+		goto err_messages;
+	if (wheel_init(&ret->queued, MESSAGE_WHEEL_SLOTS, MESSAGE_SLOT * 1000000ULL, MESSAGE_TIMEOUT_SLOTS) != ND_SUCCESS)
+		goto err_queued;
+	for (i = 0; i < OUTCOMES; i++) {
+		if (hitters_init(&ret->destinations[i], counters) != ND_SUCCESS)
+			goto err_destinations;
+		if (topn_init(&ret->top[i], shown) != ND_SUCCESS) {
+			hitters_free(&ret->destinations[i]);
+			goto err_destinations;
+		}
+	}
+	if (lateness >= 0) {
+		if (buckets_init(&ret->events, EVENT_FIELDS, timer_interval() * 1000000ULL,
+				(lateness + timer_interval() - 1) / timer_interval(), tai_now_us()) != ND_SUCCESS)
+			goto err_destinations;
+		ret->event_time = 1;
+	}
+
 	return ret;
+
+err_destinations:
+	while (i--) {
+		topn_free(&ret->top[i]);
+		hitters_free(&ret->destinations[i]);
+	}
+	wheel_free(&ret->queued);
+err_queued:
+	table_free(&ret->messages);
+err_messages:
+	wheel_free(&ret->deliveries);
+err_deliveries:
+	table_free(&ret->inflight);
+err_inflight:
+	free(ret);
+	return NULL;
+}
+
+static
+void
+send_data_fini(struct send_statistics * data) {
+	int i;
+
+	if (data->event_time)
+		buckets_free(&data->events);
+
+	for (i = 0; i < OUTCOMES; i++) {
+		topn_free(&data->top[i]);
+		hitters_free(&data->destinations[i]);
+	}
+	wheel_free(&data->queued);
+	table_free(&data->messages);
+	wheel_free(&data->deliveries);
+	table_free(&data->inflight);
+	free(data);
 }
 
 static
 void
 clear_send_statistics(struct send_statistics * data) {
-	memset(data, 0, sizeof * data);
+	int i;
+
+	data->start_delivery = 0;
+	data->end_msg = 0;
+	data->delivery_success = 0;
+	data->delivery_failure = 0;
+	data->delivery_deferral = 0;
+	data->expired = 0;
+	data->events.late = 0;
+	histogram_clear(&data->latency[CHANNEL_LOCAL]);
+	histogram_clear(&data->latency[CHANNEL_REMOTE]);
+	data->messages_expired = 0;
+	data->messages_untracked = 0;
+	histogram_clear(&data->residence);
+
+	for (i = 0; i < SIZE_BUCKETS; i++)
+		data->sizes[i] = 0;
+
+	for (i = 0; i < OUTCOMES; i++) {
+		memset(data->reasons[i], 0, sizeof data->reasons[i]);
+		hitters_clear(&data->destinations[i]);
+	}
+
+	for (i = 0; i < CHANNELS; i++) {
+		data->concurrency[i].max = data->concurrency[i].last;
+		data->concurrency[i].sum = 0;
+		data->concurrency[i].samples = 0;
+	}
+
+	hll_clear(&data->senders.tick);
+	hll_clear(&data->domains.tick);
+	hll_window_advance(&data->senders);
+	hll_window_advance(&data->domains);
 }
 
 static
 int
 print_send_hdr(const char * name) {
 	char title[BUFSIZ];
+	char id[32];
+	int i, j;
 
 	sprintf(title, "Qmail Send for %s", name);
 	nd_chart("qmail", name, "", "send qmail", title, "# send", NULL, "qmail.send", ND_CHART_TYPE_AREA);
@@ -49,42 +336,617 @@ print_send_hdr(const char * name) {
 	nd_dimension("delivery_failure",  "Failure", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
 	nd_dimension("delivery_deferral", "Deferral", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
 
+	if (env_int("QMAIL_EVENT_LATENESS", -1, -1, MAX_LATENESS) >= 0) {
+		sprintf(title, "Qmail Send lines later than the lateness window for %s", name);
+		nd_chart("qmail", name, "late", "send late", title,
+			"# lines", NULL, "qmail.send_late", ND_CHART_TYPE_LINE);
+		nd_dimension("late", "Late", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	}
+
+	sprintf(title, "Qmail Send distinct senders and recipient domains for %s", name);
+	nd_chart("qmail", name, "distinct", "send distinct", title,
+		"# distinct", NULL, "qmail.send_distinct", ND_CHART_TYPE_LINE);
+	nd_dimension("senders",   "Senders",   ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	nd_dimension("senders_5m", "Senders 5 minutes", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	nd_dimension("domains",   "Domains",   ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	nd_dimension("domains_5m", "Domains 5 minutes", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+
+	sprintf(title, "Qmail Send deliveries in flight for %s", name);
+	nd_chart("qmail", name, "inflight", "send latency", title,
+		"# deliveries", NULL, "qmail.send_inflight", ND_CHART_TYPE_LINE);
+	nd_dimension("local",   "Local",   ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	nd_dimension("remote",  "Remote",  ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	nd_dimension("expired", "Expired", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+
+	for (i = 0; i < CHANNELS; i++) {
+		sprintf(id, "latency_%s", channel_names[i]);
+		sprintf(title, "Qmail Send %s delivery duration for %s", channel_names[i], name);
+		nd_chart("qmail", name, id, "send latency", title,
+			"milliseconds", NULL, "qmail.send_latency", ND_CHART_TYPE_LINE);
+		nd_dimension("p50", "50th", ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+		nd_dimension("p90", "90th", ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+		nd_dimension("p99", "99th", ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+		nd_dimension("max", "Max",  ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+	}
+
+	sprintf(title, "Qmail Send time of messages in queue for %s", name);
+	nd_chart("qmail", name, "residence", "send residence", title,
+		"seconds", NULL, "qmail.send_residence", ND_CHART_TYPE_LINE);
+	nd_dimension("p50", "50th", ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+	nd_dimension("p99", "99th", ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+	nd_dimension("max", "Max",  ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+
+	sprintf(title, "Qmail Send messages tracked in queue for %s", name);
+	nd_chart("qmail", name, "tracked", "send residence", title,
+		"# messages", NULL, "qmail.send_tracked", ND_CHART_TYPE_LINE);
+	nd_dimension("tracked",   "Tracked",   ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	nd_dimension("expired",   "Expired",   ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	nd_dimension("untracked", "Untracked", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+
+	sprintf(title, "Qmail Send concurrency for %s", name);
+	nd_chart("qmail", name, "concurrency", "send concurrency", title,
+		"# deliveries", NULL, "qmail.send_concurrency", ND_CHART_TYPE_LINE);
+	for (i = 0; i < CHANNELS; i++) {
+		sprintf(id, "%s_max", channel_names[i]);
+		nd_dimension(id, id, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		sprintf(id, "%s_last", channel_names[i]);
+		nd_dimension(id, id, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		sprintf(id, "%s_avg", channel_names[i]);
+		nd_dimension(id, id, ND_ALG_ABSOLUTE, 1, 100, ND_VISIBLE);
+		sprintf(id, "%s_limit", channel_names[i]);
+		nd_dimension(id, id, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	}
+
+	sprintf(title, "Qmail Send concurrency utilization for %s", name);
+	nd_chart("qmail", name, "utilization", "send concurrency", title,
+		"percentage", NULL, "qmail.send_utilization", ND_CHART_TYPE_LINE);
+	nd_dimension("local",  "Local",  ND_ALG_ABSOLUTE, 1, 100, ND_VISIBLE);
+	nd_dimension("remote", "Remote", ND_ALG_ABSOLUTE, 1, 100, ND_VISIBLE);
+
+	sprintf(title, "Qmail Send bytes queued and delivered for %s", name);
+	nd_chart("qmail", name, "bytes", "send bytes", title,
+		"bytes/s", NULL, "qmail.send_bytes", ND_CHART_TYPE_LINE);
+	nd_dimension("queued", "Queued", ND_ALG_INCREMENTAL, 1, 1, ND_VISIBLE);
+	nd_dimension("local",  "Local",  ND_ALG_INCREMENTAL, 1, 1, ND_VISIBLE);
+	nd_dimension("remote", "Remote", ND_ALG_INCREMENTAL, 1, 1, ND_VISIBLE);
+
+	sprintf(title, "Qmail Send message sizes for %s", name);
+	nd_chart("qmail", name, "sizes", "send bytes", title,
+		"# messages", NULL, "qmail.send_sizes", ND_CHART_TYPE_STACKED);
+	for (i = 0; i < SIZE_BUCKETS; i++)
+		nd_dimension(size_names[i], size_names[i], ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+
+	for (i = 0; i < OUTCOMES; i++) {
+		sprintf(id, "%s_reasons", outcome_names[i]);
+		sprintf(title, "Qmail Send %s reasons for %s", outcome_names[i], name);
+		nd_chart("qmail", name, id, "send destinations", title,
+			"# deliveries", NULL, "qmail.send_reasons", ND_CHART_TYPE_STACKED);
+		for (j = 0; j < REASONS; j++)
+			nd_dimension(reason_names[j], reason_names[j], ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	}
+
 	return fflush(stdout);
 }
 
+/* One closed bucket of the main charts, time is its width */
 static
-int
-print_send_data(const char * name, const struct send_statistics * data, const unsigned long time) {
+void
+print_events(const long * row, unsigned long time, const char * name) {
 	nd_begin_time("qmail", name, "", time);
-	nd_set("start_delivery", data->start_delivery);
-	nd_set("end_msg", data->end_msg);
+	nd_set("start_delivery", row[EVENT_START_DELIVERY]);
+	nd_set("end_msg", row[EVENT_END_MSG]);
 	nd_end();
 
 	nd_begin_time("qmail", name, "delivery", time);
-	nd_set("delivery_success", data->delivery_success);
-	nd_set("delivery_failure", data->delivery_failure);
-	nd_set("delivery_deferral", data->delivery_deferral);
+	nd_set("delivery_success", row[EVENT_SUCCESS]);
+	nd_set("delivery_failure", row[EVENT_FAILURE]);
+	nd_set("delivery_deferral", row[EVENT_DEFERRAL]);
 	nd_end();
+}
+
+static
+int
+print_send_data(const char * name, const struct send_statistics * data, const unsigned long time) {
+	const struct concurrency * c;
+	const struct histogram * h;
+	char title[BUFSIZ];
+	char id[32];
+	int i, j;
+
+	if (data->event_time) {
+		buckets_emit(&data->events,
+			(void (*)(const long *, unsigned long, void *))&print_events, (void *)name);
+		nd_begin_time("qmail", name, "late", time);
+		nd_set("late", data->events.late);
+		nd_end();
+	} else {
+		nd_begin_time("qmail", name, "", time);
+		nd_set("start_delivery", data->start_delivery);
+		nd_set("end_msg", data->end_msg);
+		nd_end();
+
+		nd_begin_time("qmail", name, "delivery", time);
+		nd_set("delivery_success", data->delivery_success);
+		nd_set("delivery_failure", data->delivery_failure);
+		nd_set("delivery_deferral", data->delivery_deferral);
+		nd_end();
+	}
+
+	nd_begin_time("qmail", name, "distinct", time);
+	nd_set("senders", hll_estimate(&data->senders.tick));
+	nd_set("senders_5m", hll_window_estimate(&data->senders));
+	nd_set("domains", hll_estimate(&data->domains.tick));
+	nd_set("domains_5m", hll_window_estimate(&data->domains));
+	nd_end();
+
+	nd_begin_time("qmail", name, "inflight", time);
+	nd_set("local", data->inflight_count[CHANNEL_LOCAL]);
+	nd_set("remote", data->inflight_count[CHANNEL_REMOTE]);
+	nd_set("expired", data->expired);
+	nd_end();
+
+	/* Values are left empty in ticks without finished deliveries */
+	for (i = 0; i < CHANNELS; i++) {
+		h = &data->latency[i];
+		sprintf(id, "latency_%s", channel_names[i]);
+		nd_begin_time("qmail", name, id, time);
+		if (h->total) {
+			nd_set("p50", histogram_percentile(h, 500));
+			nd_set("p90", histogram_percentile(h, 900));
+			nd_set("p99", histogram_percentile(h, 990));
+			nd_set("max", h->max);
+		}
+		nd_end();
+	}
+
+	nd_begin_time("qmail", name, "residence", time);
+	if (data->residence.total) {
+		nd_set("p50", histogram_percentile(&data->residence, 500));
+		nd_set("p99", histogram_percentile(&data->residence, 990));
+		nd_set("max", data->residence.max);
+	}
+	nd_end();
+
+	nd_begin_time("qmail", name, "tracked", time);
+	nd_set("tracked", data->messages.len);
+	nd_set("expired", data->messages_expired);
+	nd_set("untracked", data->messages_untracked);
+	nd_end();
+
+	/* Values are left empty until the first status line */
+	nd_begin_time("qmail", name, "concurrency", time);
+	for (i = 0; i < CHANNELS; i++) {
+		c = &data->concurrency[i];
+		if (!c->limit)
+			continue;
+		sprintf(id, "%s_max", channel_names[i]);
+		nd_set(id, c->max);
+		sprintf(id, "%s_last", channel_names[i]);
+		nd_set(id, c->last);
+		sprintf(id, "%s_avg", channel_names[i]);
+		nd_set(id, c->samples ? c->sum * 100 / c->samples : c->last * 100);
+		sprintf(id, "%s_limit", channel_names[i]);
+		nd_set(id, c->limit);
+	}
+	nd_end();
+
+	nd_begin_time("qmail", name, "utilization", time);
+	for (i = 0; i < CHANNELS; i++) {
+		c = &data->concurrency[i];
+		if (c->limit)
+			nd_set(channel_names[i], (c->samples ? c->sum * 10000 / c->samples : c->last * 10000) / c->limit);
+	}
+	nd_end();
+
+	nd_begin_time("qmail", name, "bytes", time);
+	nd_set("queued", data->bytes_queued);
+	nd_set("local", data->bytes_delivered[CHANNEL_LOCAL]);
+	nd_set("remote", data->bytes_delivered[CHANNEL_REMOTE]);
+	nd_end();
+
+	nd_begin_time("qmail", name, "sizes", time);
+	for (i = 0; i < SIZE_BUCKETS; i++)
+		nd_set(size_names[i], data->sizes[i]);
+	nd_end();
+
+	for (i = 0; i < OUTCOMES; i++) {
+		sprintf(id, "%s_reasons", outcome_names[i]);
+		nd_begin_time("qmail", name, id, time);
+		for (j = 0; j < REASONS; j++)
+			nd_set(reason_names[j], data->reasons[i][j]);
+		nd_end();
+
+		sprintf(id, "%s_destinations", outcome_names[i]);
+		sprintf(title, "Qmail Send remote destinations with %s for %s", outcome_names[i], name);
+		topn_print(&data->top[i], "qmail", name, id, title, "# deliveries", "send destinations",
+			"qmail.send_destinations", time);
+	}
 
 	return fflush(stdout);
 }
 
+/* Numbers are read in place from the line, -1 is returned if there is no
+ * digit. */
+static inline
+long
+parse_number(const char ** ptr) {
+	const char * p = *ptr;
+	long value = 0;
+
+	if (*p < '0' || *p > '9')
+		return -1;
+
+	for (; *p >= '0' && *p <= '9'; p++)
+		value = value * 10 + *p - '0';
+
+	*ptr = p;
+	return value;
+}
+
+/* Copies the domain of the address in lower case */
+static
+void
+set_domain(char * domain, const char * addr) {
+	const char * at = strrchr(addr, '@');
+	size_t i;
+
+	addr = at ? at + 1 : addr;
+	for (i = 0; i < HITTER_NAME_MAX - 1 && addr[i]; i++)
+		domain[i] = tolower((unsigned char)addr[i]);
+	domain[i] = '\0';
+}
+
+static
+enum reason
+classify_reason(const char * text) {
+	size_t i;
+
+	for (i = 0; i < sizeof reason_texts / sizeof reason_texts[0]; i++)
+		if (strstr(text, reason_texts[i].text))
+			return reason_texts[i].reason;
+
+	return REASON_OTHER;
+}
+
+/* Length of the address qmail-remote puts at the beginning of the reason,
+ * as in "1.2.3.4_does_not_like_recipient." or "Connected_to_1.2.3.4_but...",
+ * 0 if there is none. */
+static
+size_t
+remote_host(const char ** text) {
+	const char * p;
+
+	if (!strncmp(*text, "Connected_to_", sizeof "Connected_to_" - 1))
+		*text += sizeof "Connected_to_" - 1;
+
+	for (p = *text; isxdigit((unsigned char)*p) || *p == '.' || *p == ':'; p++)
+		;
+
+	return *p == '_' && p - *text < HITTER_NAME_MAX ? p - *text : 0;
+}
+
+/* Remote deliveries are counted by the host which refused them, or by the
+ * recipient domain when the host is not known. */
+static
+void
+count_outcome(const char * text, const enum outcome outcome,
+		const struct delivery * delivery, struct send_statistics * data) {
+	size_t len;
+
+	data->reasons[outcome][classify_reason(text)]++;
+
+	if ((len = remote_host(&text)))
+		hitters_offer(&data->destinations[outcome], text, len);
+	else if (delivery && delivery->channel == CHANNEL_REMOTE && delivery->domain[0])
+		hitters_offer(&data->destinations[outcome], delivery->domain, strlen(delivery->domain));
+}
+
+static
+void
+start_delivery(const char * ptr, struct send_statistics * data) {
+	struct delivery * delivery;
+	struct message * message;
+	enum channel channel;
+	long id, inode;
+
+	/* "starting delivery D: msg M to local|remote ..." */
+	ptr += sizeof "starting delivery" - 1;
+	if (*ptr++ != ' ' || (id = parse_number(&ptr)) <= 0 || strncmp(ptr, ": msg ", sizeof ": msg " - 1))
+		return;
+	ptr += sizeof ": msg " - 1;
+	inode = parse_number(&ptr);
+
+	if (!strncmp(ptr, " to local ", sizeof " to local " - 1))
+		channel = CHANNEL_LOCAL;
+	else if (!strncmp(ptr, " to remote ", sizeof " to remote " - 1))
+		channel = CHANNEL_REMOTE;
+	else
+		return;
+
+	delivery = table_insert(&data->inflight, id);
+	if (delivery == NULL)
+		return;
+
+	/* The id is known if qmail-send restarted without its end line */
+	if (delivery->start)
+		data->inflight_count[delivery->channel]--;
+
+	delivery->start = data->now;
+	delivery->slot = wheel_slot(&data->deliveries, data->now);
+	delivery->channel = channel;
+	message = inode > 0 ? table_find(&data->messages, inode) : NULL;
+	delivery->bytes = message ? message->bytes : 0;
+	delivery->domain[0] = '\0';
+	if (channel == CHANNEL_REMOTE)
+		set_domain(delivery->domain, ptr + sizeof " to remote " - 1);
+	data->inflight_count[channel]++;
+	wheel_add(&data->deliveries, delivery->slot, id);
+}
+
+static
+void
+end_delivery(const char * ptr, struct send_statistics * data) {
+	struct delivery * delivery;
+	long id;
+
+	/* "delivery D: success|failure|deferral: ..." */
+	ptr += sizeof "delivery " - 1;
+	if ((id = parse_number(&ptr)) <= 0 || *ptr != ':')
+		return;
+
+	delivery = table_find(&data->inflight, id);
+
+	if (!strncmp(ptr, ": deferral: ", sizeof ": deferral: " - 1))
+		count_outcome(ptr + sizeof ": deferral: " - 1, OUTCOME_DEFERRAL, delivery, data);
+	else if (!strncmp(ptr, ": failure: ", sizeof ": failure: " - 1))
+		count_outcome(ptr + sizeof ": failure: " - 1, OUTCOME_FAILURE, delivery, data);
+
+	if (delivery == NULL)
+		return;
+
+	if (!strncmp(ptr, ": success:", sizeof ": success:" - 1))
+		data->bytes_delivered[delivery->channel] += delivery->bytes;
+
+	histogram_add(&data->latency[delivery->channel],
+		data->now > delivery->start ? data->now - delivery->start : 0);
+	data->inflight_count[delivery->channel]--;
+	table_remove(&data->inflight, id);
+}
+
+/* The ids of a slot are either finished, restarted in a later slot, or lost.
+ * Only the lost ones still have the slot in the table. */
+static
+void
+expire_delivery(uint64_t id, uint64_t slot, struct send_statistics * data) {
+	struct delivery * delivery = table_find(&data->inflight, id);
+
+	if (delivery && delivery->slot <= slot) {
+		data->inflight_count[delivery->channel]--;
+		data->expired++;
+		table_remove(&data->inflight, id);
+	}
+}
+
+static
+void
+update_concurrency(struct concurrency * c, const long used, const long limit) {
+	c->last = used;
+	c->limit = limit;
+	if (c->max < used)
+		c->max = used;
+	c->sum += used;
+	c->samples++;
+}
+
+/* "status: local l/L remote r/R", qmail-send logs it whenever a delivery
+ * starts or ends. */
+static
+void
+count_status(const char * ptr, struct send_statistics * data) {
+	long local, local_limit, remote, remote_limit;
+
+	ptr += sizeof "status: local " - 1;
+	if ((local = parse_number(&ptr)) < 0 || *ptr++ != '/'
+			|| (local_limit = parse_number(&ptr)) <= 0)
+		return;
+
+	if (strncmp(ptr, " remote ", sizeof " remote " - 1))
+		return;
+	ptr += sizeof " remote " - 1;
+	if ((remote = parse_number(&ptr)) < 0 || *ptr++ != '/'
+			|| (remote_limit = parse_number(&ptr)) <= 0)
+		return;
+
+	update_concurrency(&data->concurrency[CHANNEL_LOCAL], local, local_limit);
+	update_concurrency(&data->concurrency[CHANNEL_REMOTE], remote, remote_limit);
+}
+
+/* "new msg M" */
+static
+void
+new_message(const char * ptr, struct send_statistics * data) {
+	struct message * message;
+	long inode;
+
+	ptr += sizeof "new msg " - 1;
+	if ((inode = parse_number(&ptr)) <= 0)
+		return;
+
+	if (data->messages.len >= data->max_messages && !table_find(&data->messages, inode)) {
+		data->messages_untracked++;
+		return;
+	}
+
+	message = table_insert(&data->messages, inode);
+	if (message == NULL)
+		return;
+
+	message->start = data->now;
+	message->bytes = 0;
+	message->slot = wheel_slot(&data->queued, data->now);
+	wheel_add(&data->queued, message->slot, inode);
+}
+
+/* "end msg M" */
+static
+void
+end_message(const char * ptr, struct send_statistics * data) {
+	struct message * message;
+	long inode;
+
+	ptr += sizeof "end msg" - 1;
+	inode = *ptr == ' ' ? (ptr++, parse_number(&ptr)) : -1;
+	message = inode > 0 ? table_find(&data->messages, inode) : NULL;
+	if (message == NULL)
+		return;
+
+	histogram_add(&data->residence,
+		data->now > message->start ? (data->now - message->start) / 1000 : 0);
+	table_remove(&data->messages, inode);
+}
+
+static
+void
+expire_message(uint64_t inode, uint64_t slot, struct send_statistics * data) {
+	struct message * message = table_find(&data->messages, inode);
+
+	if (message && message->slot <= slot) {
+		data->messages_expired++;
+		table_remove(&data->messages, inode);
+	}
+}
+
+/* The destinations are ranked and the event buckets closed for the print.
+ * Time is taken from the log, so the expiry follows the lines even if they
+ * are read late. */
+static
+void
+expire_send(struct send_statistics * data) {
+	const struct hitters * d;
+	size_t k;
+	int i;
+
+	for (i = 0; i < OUTCOMES; i++) {
+		d = &data->destinations[i];
+		topn_clear(&data->top[i]);
+		for (k = 0; k < d->len; k++)
+			topn_offer(&data->top[i], d->heap[k].name, strlen(d->heap[k].name), d->heap[k].count);
+		topn_update(&data->top[i]);
+	}
+
+	if (data->event_time)
+		buckets_close(&data->events, tai_now_us());
+
+	if (!data->now)
+		return;
+
+	wheel_expire(&data->deliveries, data->now, (void (*)(uint64_t, uint64_t, void *))&expire_delivery, data);
+	wheel_expire(&data->queued, data->now, (void (*)(uint64_t, uint64_t, void *))&expire_message, data);
+}
+
+/* "starting delivery D: msg M to local|remote user@domain" */
+static
+void
+count_domain(const char * ptr, struct send_statistics * data) {
+	const char * domain, * end;
+
+	ptr = strstr(ptr, " to ");
+	if (ptr == NULL)
+		return;
+
+	end = ptr + strlen(ptr);
+	for (domain = end; domain > ptr && domain[-1] != '@'; domain--)
+		;
+	if (domain > ptr)
+		hll_window_add(&data->domains, hash_u64(hash_mem(domain, end - domain)));
+}
+
+/* "info msg M: bytes B from <sender> qp Q uid U", the bounce sender <> counts
+ * as one sender. */
+static
+void
+count_sender(const char * ptr, struct send_statistics * data) {
+	const char * end;
+
+	ptr = strstr(ptr, " from <");
+	if (ptr == NULL)
+		return;
+
+	ptr += sizeof " from <" - 1;
+	end = strchr(ptr, '>');
+	if (end)
+		hll_window_add(&data->senders, hash_u64(hash_mem(ptr, end - ptr)));
+}
+
+/* "info msg M: bytes B from <sender> ..." */
+static
+void
+count_size(const char * ptr, struct send_statistics * data) {
+	struct message * message;
+	long inode, bytes;
+	int i;
+
+	ptr += sizeof "info msg " - 1;
+	if ((inode = parse_number(&ptr)) <= 0 || strncmp(ptr, ": bytes ", sizeof ": bytes " - 1))
+		return;
+	ptr += sizeof ": bytes " - 1;
+	if ((bytes = parse_number(&ptr)) < 0)
+		return;
+
+	data->bytes_queued += bytes;
+	for (i = 0; i < SIZE_BUCKETS - 1 && bytes >= 1024L << 2 * i; i++)
+		;
+	data->sizes[i]++;
+
+	message = table_find(&data->messages, inode);
+	if (message)
+		message->bytes = bytes;
+}
+
+static inline
+void
+count_event(struct send_statistics * data, const enum event_field field) {
+	if (data->event_time)
+		buckets_add(&data->events, data->now, field);
+}
+
 static
 void
 process_send_log_line(const char * line, struct send_statistics * data) {
 	const char * ptr;
 
-	if (strstr(line, "starting delivery")) {
+	/* multilog t labels lines by TAI64N, otherwise they are read right after
+	 * they are written. */
+	if (tai64n_parse(line, &data->now))
+		data->now = tai_now_us();
+
+	if ((ptr = strstr(line, "starting delivery"))) {
 		data->start_delivery++;
-	} else if (strstr(line, "end msg")) {
+		count_event(data, EVENT_START_DELIVERY);
+		count_domain(ptr, data);
+		start_delivery(ptr, data);
+	} else if ((ptr = strstr(line, "info msg "))) {
+		count_sender(ptr, data);
+		count_size(ptr, data);
+	} else if ((ptr = strstr(line, "status: local "))) {
+		count_status(ptr, data);
+	} else if ((ptr = strstr(line, "new msg "))) {
+		new_message(ptr, data);
+	} else if ((ptr = strstr(line, "end msg"))) {
 		data->end_msg++;
+		count_event(data, EVENT_END_MSG);
+		end_message(ptr, data);
 	} else if ((ptr = strstr(line, "delivery "))) {
+		end_delivery(ptr, data);
 		if (strstr(ptr, "success:")) {
 			data->delivery_success++;
+			count_event(data, EVENT_SUCCESS);
 		} else if (strstr(ptr, "failure:")) {
 			data->delivery_failure++;
+			count_event(data, EVENT_FAILURE);
 		} else if (strstr(ptr, "deferral:")) {
 			data->delivery_deferral++;
+			count_event(data, EVENT_DEFERRAL);
 		}
 	}
 }
@@ -92,12 +954,12 @@ process_send_log_line(const char * line, struct send_statistics * data) {
 static
 struct stat_func send = {
 	.init = &send_data_init,
-	.fini = &free,
+	.fini = (void (*)(void *))&send_data_fini,
 
 	.print_hdr   = &print_send_hdr,
 	.print       = (int (*)(const char *, const void *, unsigned long))&print_send_data,
 	.process     = (void (*)(const char *, void *))&process_send_log_line,
-	.postprocess = NULL,
+	.postprocess = (void (*)(void *))&expire_send,
 	.clear       = (void (*)(void *))&clear_send_statistics,
 };
 
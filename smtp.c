@@ -1,13 +1,28 @@
 /* SPDX-License-Identifier: GPL-3.0-or-later */
 
+#include <arpa/inet.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "callbacks.h"
+#include "env.h"
 #include "netdata.h"
 #include "err.h"
+#include "hash.h"
+#include "table.h"
+#include "topn.h"
 #include "vector.h"
+#include "dict.h"
+#include "hitters.h"
+#include "hll.h"
+#include "histogram.h"
+#include "tai.h"
+#include "timer.h"
+#include "trie.h"
+#include "wheel.h"
+#include "bucket.h"
 
 #include "smtp.h"
 
@@ -22,9 +37,98 @@ struct ratelimitspp_statistics {
 	int ratelimited;
 };
 
+#define RULENAME_MAX 256
+
+/* Rules above the limit are not charted, MAXCONNIP rules may be numerous. */
+#define MAX_RULES (1 << 16)
+
+/* Clients producing deny and ratelimitspp NOK lines are summarized by
+ * DEFAULT_OFFENDER_COUNTERS counters, the biggest DEFAULT_OFFENDERS of them
+ * are charted. Both can be changed by environment variables. */
+#define DEFAULT_OFFENDER_COUNTERS 1000
+#define DEFAULT_OFFENDERS 10
+#define MAX_OFFENDER_COUNTERS (1 << 20)
+#define MAX_OFFENDERS 100
+
+/* Denies and connections are aggregated by networks of these prefix lengths,
+ * the biggest DEFAULT_NETWORKS networks of each length are charted. */
+#define DEFAULT_PREFIXES4 "24,16"
+#define DEFAULT_PREFIXES6 "48"
+#define DEFAULT_NETWORKS 10
+#define DEFAULT_PREFIX_NODES (1 << 17)
+#define MAX_NETWORKS 100
+#define MAX_PREFIX_NODES (1 << 24)
+#define MAX_PREFIXES 4
+
+enum network_counter {
+	NETWORK_DENY = 0,
+	NETWORK_OK,
+};
+
+/* Protocol and cipher pairs of ESMTPS lines become dimensions up to this
+ * number, further pairs are counted as other. */
+#define DEFAULT_CIPHERS 32
+#define MAX_CIPHERS 1024
+#define CIPHER_NAME_MAX 128
+
+/* Sessions without their end line are dropped after SESSION_TIMEOUT_SLOTS
+ * slots of a minute, qmail-smtpd times out idle clients much sooner. */
+#define SESSION_SLOT 60
+#define SESSION_TIMEOUT_SLOTS 60
+#define SESSION_WHEEL_SLOTS 64
+
+enum session_status {
+	SESSION_STATUS_0 = 0,
+	SESSION_STATUS_256,
+	SESSION_STATUS_25600,
+	SESSION_STATUS_OTHER,
+	SESSION_STATUSES
+};
+
+static const char * const session_status_names[SESSION_STATUSES] = {
+	[SESSION_STATUS_0]     = "0",
+	[SESSION_STATUS_256]   = "256",
+	[SESSION_STATUS_25600] = "25600",
+	[SESSION_STATUS_OTHER] = "other",
+};
+
+struct session {
+	uint64_t start;              /* microseconds of UNIX time */
+	uint64_t slot;               /* slot of start in the wheel */
+};
+
+/* Connections are counted in slots of BURST_SLOT microseconds by their time.
+ * The ring of BURST_SLOTS slots takes lines read a few seconds late. */
+#define BURST_SLOT 100000
+#define BURST_SLOTS 64
+#define BURST_SLOTS_PER_SECOND (1000000 / BURST_SLOT)
+
+struct burst_slot {
+	uint64_t slot;               /* time / BURST_SLOT */
+	int count;
+};
+
+/* Peak of the slots of this tick and the slots the tick spans */
+struct burst {
+	struct burst_slot ring[BURST_SLOTS];
+	int peak;
+	int events;
+	uint64_t first;
+	uint64_t last;
+};
+
+/* Seconds lines may come late in the event time mode */
+#define MAX_LATENESS 3600
+
+/* Connections counted by their time when QMAIL_EVENT_LATENESS is set */
+enum event_field {
+	EVENT_OK,
+	EVENT_DENY,
+	EVENT_FIELDS
+};
+
 struct limit_t {
 	int count;
-	char rulename[256];
 	int new;
 };
 
@@ -74,16 +178,35 @@ struct smtp_statistics_scalar {
 	struct ratelimitspp_statistics ratelimitspp;
 };
 
-struct smtp_statistics_vector {
-	struct vector maxconnnet;
-	struct vector maxconnip;
-	struct vector maxconnrule;
-	struct vector maxload;
+/* Limits are counted by all smtp watchers into shared tables keyed by id of
+ * the rule name + 1, names are interned in rulenames. */
+struct smtp_limits {
+	struct table maxconnnet;
+	struct table maxconnip;
+	struct table maxconnrule;
+	struct table maxload;
 };
 
 struct smtp_statistics {
-	struct smtp_statistics_vector ssv;
 	struct smtp_statistics_scalar sss;
+	struct hll_window clients;   /* distinct client addresses */
+
+	uint64_t now;                /* time of the last line */
+	struct table sessions;       /* tcpserver pid -> struct session */
+	struct wheel session_wheel;  /* pids by start */
+	struct histogram duration[SESSION_STATUSES]; /* milliseconds of this tick */
+
+	struct burst burst;          /* tcpserver ok and deny lines */
+
+	struct dict ciphers;         /* "protocol cipher" pairs */
+	int * cipher_counts;         /* by id of the pair */
+	int ciphers_max;
+	int ciphers_shown;           /* ids below were announced before */
+	int ciphers_announced;       /* ids below are dimensions */
+	int ciphers_other;
+
+	int event_time;              /* main chart is fed from events */
+	struct buckets events;
 };
 
 static
@@ -92,29 +215,196 @@ ratelimitspp_statistics aggregated_ratelimtspp;
 
 static
 struct
-smtp_statistics_vector aggregated_limits;
+smtp_limits aggregated_limits;
+
+static
+struct
+dict rulenames = DICT_EMPTY;
+
+/* Clients of deny and ratelimitspp NOK lines of the current tick */
+static
+struct {
+	struct hitters deny;
+	struct hitters ratelimited;
+	struct topn top_deny;
+	struct topn top_ratelimited;
+	long ratelimited_error;
+	int hdr_printed;
+} offenders;
+
+/* Distinct clients of all smtp watchers, merged from their sketches */
+static
+struct {
+	struct hll_window window;
+	int hdr_printed;
+} aggregated_clients;
+
+/* Client networks of deny and ok lines of the current tick */
+struct network_family {
+	struct trie trie;
+	int af;
+	const char * suffix;                       /* of chart ids */
+	unsigned lengths[MAX_PREFIXES];
+	int count;
+	struct topn top[MAX_PREFIXES][2];          /* by length and counter */
+};
+
+static
+struct {
+	struct network_family v4;
+	struct network_family v6;
+	int hdr_printed;
+} networks;
+
+static
+int
+smtp_watchers;
+
+static
+void
+network_family_free(struct network_family * f) {
+	int i;
+
+	trie_free(&f->trie);
+	for (i = 0; i < f->count; i++) {
+		topn_free(&f->top[i][NETWORK_DENY]);
+		topn_free(&f->top[i][NETWORK_OK]);
+	}
+}
+
+/* Prefix lengths are given as a comma separated list, e.g. "24,16". */
+static
+enum nd_err
+network_family_init(struct network_family * f, const int af, const char * env, const char * def) {
+	const unsigned max = af == AF_INET ? 32 : 128;
+	const int shown = env_int("QMAIL_SMTP_NETWORKS", DEFAULT_NETWORKS, 1, MAX_NETWORKS);
+	const char * list = getenv(env);
+	unsigned depth = 0;
+	long len;
+	char * end;
+	int i;
+
+	f->af = af;
+	f->suffix = af == AF_INET ? "" : "6";
+	f->count = 0;
+	for (list = list && *list ? list : def; *list && f->count < MAX_PREFIXES; list = end) {
+		len = strtol(list, &end, 10);
+		if (end == list || len < 1 || len > max) {
+			fprintf(stderr, "Ignoring invalid prefix length in %s: '%s'\n", env, list);
+			break;
+		}
+		f->lengths[f->count++] = len;
+		depth = len > depth ? len : depth;
+		end += strspn(end, ", ");
+	}
+
+	for (i = 0; i < f->count; i++)
+		if (topn_init(&f->top[i][NETWORK_DENY], shown) != ND_SUCCESS
+				|| topn_init(&f->top[i][NETWORK_OK], shown) != ND_SUCCESS)
+			return ND_ALLOC;
+
+	return trie_init(&f->trie, env_int("QMAIL_SMTP_PREFIX_NODES", DEFAULT_PREFIX_NODES, 1, MAX_PREFIX_NODES), depth);
+}
+
+static
+void
+aggregated_free() {
+	table_free(&aggregated_limits.maxload);
+	table_free(&aggregated_limits.maxconnnet);
+	table_free(&aggregated_limits.maxconnip);
+	table_free(&aggregated_limits.maxconnrule);
+	dict_free(&rulenames);
+	hitters_free(&offenders.deny);
+	hitters_free(&offenders.ratelimited);
+	topn_free(&offenders.top_deny);
+	topn_free(&offenders.top_ratelimited);
+	network_family_free(&networks.v4);
+	network_family_free(&networks.v6);
+}
+
+static
+enum nd_err
+aggregated_init() {
+	const int counters = env_int("QMAIL_SMTP_OFFENDER_COUNTERS", DEFAULT_OFFENDER_COUNTERS, 1, MAX_OFFENDER_COUNTERS);
+	const int shown = env_int("QMAIL_SMTP_OFFENDERS", DEFAULT_OFFENDERS, 1, MAX_OFFENDERS);
+
+	if (table_init(&aggregated_limits.maxload, sizeof(struct limit_t)) != ND_SUCCESS
+			|| table_init(&aggregated_limits.maxconnnet, sizeof(struct limit_t)) != ND_SUCCESS
+			|| table_init(&aggregated_limits.maxconnip, sizeof(struct limit_t)) != ND_SUCCESS
+			|| table_init(&aggregated_limits.maxconnrule, sizeof(struct limit_t)) != ND_SUCCESS
+			|| dict_init(&rulenames) != ND_SUCCESS
+			|| hitters_init(&offenders.deny, counters) != ND_SUCCESS
+			|| hitters_init(&offenders.ratelimited, counters) != ND_SUCCESS
+			|| topn_init(&offenders.top_deny, shown) != ND_SUCCESS
+			|| topn_init(&offenders.top_ratelimited, shown) != ND_SUCCESS
+			|| network_family_init(&networks.v4, AF_INET, "QMAIL_SMTP_PREFIXES4", DEFAULT_PREFIXES4) != ND_SUCCESS
+			|| network_family_init(&networks.v6, AF_INET6, "QMAIL_SMTP_PREFIXES6", DEFAULT_PREFIXES6) != ND_SUCCESS) {
+		aggregated_free();
+		return ND_ALLOC;
+	}
+
+	hll_window_init(&aggregated_clients.window);
+	return ND_SUCCESS;
+}
 
 static
 void *
 smtp_data_init() {
 	struct smtp_statistics * ret;
+	int lateness;
+
+	/* The shared tables are created with the first watcher */
+	if (!smtp_watchers && aggregated_init() != ND_SUCCESS)
+		return NULL;
+
 	ret = calloc(1, sizeof * ret);
-	vector_init(&ret->ssv.maxload, sizeof(struct limit_t));
-	vector_init(&ret->ssv.maxconnnet, sizeof(struct limit_t));
-	vector_init(&ret->ssv.maxconnip, sizeof(struct limit_t));
-	vector_init(&ret->ssv.maxconnrule, sizeof(struct limit_t));
-	vector_init(&aggregated_limits.maxload, sizeof(struct limit_t));
-	vector_init(&aggregated_limits.maxconnnet, sizeof(struct limit_t));
-	vector_init(&aggregated_limits.maxconnip, sizeof(struct limit_t));
-	vector_init(&aggregated_limits.maxconnrule, sizeof(struct limit_t));
+	if (ret == NULL)
+		goto err_alloc;
+
+	if (table_init(&ret->sessions, sizeof(struct session)) != ND_SUCCESS)
+		goto err_sessions;
+	if (wheel_init(&ret->session_wheel, SESSION_WHEEL_SLOTS, SESSION_SLOT * 1000000ULL, SESSION_TIMEOUT_SLOTS) != ND_SUCCESS)
+		goto err_wheel;
+	ret->ciphers_max = env_int("QMAIL_SMTP_CIPHERS", DEFAULT_CIPHERS, 0, MAX_CIPHERS);
+	if (dict_init(&ret->ciphers) != ND_SUCCESS)
+		goto err_ciphers;
+	if (!(ret->cipher_counts = calloc(ret->ciphers_max + 1, sizeof * ret->cipher_counts)))
+		goto err_cipher_counts;
+	if ((lateness = env_int("QMAIL_EVENT_LATENESS", -1, -1, MAX_LATENESS)) >= 0) {
+		if (buckets_init(&ret->events, EVENT_FIELDS, timer_interval() * 1000000ULL,
+				(lateness + timer_interval() - 1) / timer_interval(), tai_now_us()) != ND_SUCCESS)
+			goto err_events;
+		ret->event_time = 1;
+	}
+
+	hll_window_init(&ret->clients);
+	smtp_watchers++;
 	return ret;
+
+err_events:
+	free(ret->cipher_counts);
+err_cipher_counts:
+	dict_free(&ret->ciphers);
+err_ciphers:
+	wheel_free(&ret->session_wheel);
+err_wheel:
+	table_free(&ret->sessions);
+err_sessions:
+	free(ret);
+err_alloc:
+	if (!smtp_watchers)
+		aggregated_free();
+	return NULL;
 }
 
+/* Returns length of the rule name, it is copied up to the closing parenthesis
+ * and dots are replaced as they separate parts of netdata ids. */
 static
-void
+size_t
 set_rulename(char * name_d, const char * name_s, const size_t size) {
-	memset(name_d, 0, size);
-	for (int i = 0; i < size - 1; i++) {
+	size_t i;
+
+	for (i = 0; i < size - 1; i++) {
 		if (name_s[i] == '\0' || name_s[i] == ')') {
 			break;
 		}
@@ -124,84 +414,328 @@ set_rulename(char * name_d, const char * name_s, const size_t size) {
 			name_d[i] = name_s[i];
 		}
 	}
+	name_d[i] = '\0';
+
+	return i;
 }
 
+/* One hash of the name and one probe of the table, whatever the number of
+ * rules is. */
 static
 void
-update_limit(struct vector * limits, const char * rulename_p) {
-	struct limit_t * _limit = 0;
-	struct limit_t limit;
+update_limit(struct table * limits, const char * rulename_p) {
+	char rulename[RULENAME_MAX];
+	struct limit_t * limit;
+	size_t len;
+	long id;
 
-	set_rulename(limit.rulename, rulename_p, sizeof limit.rulename);
+	len = set_rulename(rulename, rulename_p, sizeof rulename);
+	id = dict_intern(&rulenames, rulename, len);
+	if (id < 0)
+		return;
 
-	for (int i = 0; i < limits->len; i++) {
-		_limit = vector_item(limits, i);
-		if (strcmp(_limit->rulename, limit.rulename))
-			_limit = 0;
+	limit = table_find(limits, id + 1);
+	if (limit == NULL) {
+		if (limits->len >= MAX_RULES)
+			return;
+		limit = table_insert(limits, id + 1);
+		if (limit == NULL)
+			return;
+		limit->new = 1;
 	}
+	limit->count++;
+}
+
+/* The remote end of tcpserver lines is "host:ip:info:port". The host cannot
+ * contain a colon, an IPv6 address can, so the address lies between the first
+ * colon and the last but one. ptr points to the pid after ok or deny. */
+static
+size_t
+remote_address(const char * ptr, const char ** addr) {
+	const char * first, * last, * info, * end;
+
+	/* pid local remote */
+	ptr += strspn(ptr, " ");
+	if (!(ptr = strchr(ptr, ' ')) || !(ptr = strchr(ptr + 1, ' ')))
+		return 0;
+	ptr++;
+	end = ptr + strcspn(ptr, " \n");
+
+	first = memchr(ptr, ':', end - ptr);
+	if (first == NULL)
+		return 0;
+	for (last = end - 1; last > first && *last != ':'; last--)
+		;
+	for (info = last - 1; info > first && *info != ':'; info--)
+		;
+	if (info <= first)
+		return 0;
+
+	*addr = first + 1;
+	return info - first - 1;
+}
 
-	if (_limit) {
-		_limit->count++;
+/* ratelimitspp logs the client among other fields, the first token which is
+ * an IPv4 or IPv6 address is taken. A "name:" prefix of the token is skipped. */
+static
+size_t
+find_address(const char * ptr, char * buf, const size_t size) {
+	unsigned char addr[sizeof(struct in6_addr)];
+	const char * colon;
+	size_t len;
+
+	for (; *ptr; ptr += len) {
+		ptr += strspn(ptr, " ;,=()[]<>\t");
+		len = strcspn(ptr, " ;,=()[]<>\t\n");
+		if (len == 0 || len >= size)
+			continue;
+
+		memcpy(buf, ptr, len);
+		buf[len] = '\0';
+		if (inet_pton(AF_INET, buf, addr) == 1 || inet_pton(AF_INET6, buf, addr) == 1)
+			return len;
+
+		colon = strchr(buf, ':');
+		if (colon && (inet_pton(AF_INET, colon + 1, addr) == 1 || inet_pton(AF_INET6, colon + 1, addr) == 1)) {
+			len -= colon + 1 - buf;
+			memmove(buf, colon + 1, len + 1);
+			return len;
+		}
 	}
-	else {
-		limit.count = 1;
-		vector_add(limits, &limit);
+
+	return 0;
+}
+
+/* IPv4 mapped IPv6 addresses are counted as IPv4. */
+static
+void
+count_network(const char * addr, const size_t len, const enum network_counter counter) {
+	char buf[INET6_ADDRSTRLEN];
+	struct in6_addr in6;
+	struct in_addr in;
+
+	if (len >= sizeof buf)
+		return;
+	memcpy(buf, addr, len);
+	buf[len] = '\0';
+
+	if (inet_pton(AF_INET, buf, &in) == 1) {
+		trie_add(&networks.v4.trie, (const uint8_t *)&in, counter);
+	} else if (inet_pton(AF_INET6, buf, &in6) == 1) {
+		if (IN6_IS_ADDR_V4MAPPED(&in6))
+			trie_add(&networks.v4.trie, in6.s6_addr + 12, counter);
+		else
+			trie_add(&networks.v6.trie, in6.s6_addr, counter);
 	}
 }
 
+static
+void
+count_client(struct smtp_statistics * data, const char * addr, const size_t len) {
+	hll_window_add(&data->clients, hash_u64(hash_mem(addr, len)));
+}
+
+/* "tcpserver: pid P from A" */
+static
+void
+start_session(const char * ptr, struct smtp_statistics * data) {
+	struct session * session;
+	long pid;
+
+	pid = strtol(ptr + sizeof "tcpserver: pid " - 1, NULL, 10);
+	if (pid <= 0)
+		return;
+
+	session = table_insert(&data->sessions, pid);
+	if (session == NULL)
+		return;
+
+	session->start = data->now;
+	session->slot = wheel_slot(&data->session_wheel, data->now);
+	wheel_add(&data->session_wheel, session->slot, pid);
+}
+
+/* "tcpserver: end P status S" */
+static
+void
+end_session(const char * ptr, const enum session_status status, struct smtp_statistics * data) {
+	struct session * session;
+	long pid;
+
+	pid = strtol(ptr + sizeof "tcpserver: end " - 1, NULL, 10);
+	session = pid > 0 ? table_find(&data->sessions, pid) : NULL;
+	if (session == NULL)
+		return;
+
+	histogram_add(&data->duration[status],
+		data->now > session->start ? (data->now - session->start) / 1000 : 0);
+	table_remove(&data->sessions, pid);
+}
+
+/* The pid of a slot is either ended, reused by a later session, or lost */
+static
+void
+expire_session(uint64_t pid, uint64_t slot, struct smtp_statistics * data) {
+	struct session * session = table_find(&data->sessions, pid);
+
+	if (session && session->slot <= slot)
+		table_remove(&data->sessions, pid);
+}
+
+/* A slot is reused once the ring turns, lines older than the ring are only
+ * counted in the tick. */
+static
+void
+count_burst(struct burst * b, const uint64_t now) {
+	const uint64_t slot = now / BURST_SLOT;
+	struct burst_slot * s = &b->ring[slot % BURST_SLOTS];
+
+	if (!b->events++) {
+		b->first = slot;
+		b->last = slot;
+	} else if (slot < b->first) {
+		b->first = slot;
+	} else if (slot > b->last) {
+		b->last = slot;
+	}
+
+	if (s->slot > slot)
+		return;
+	if (s->slot < slot) {
+		s->slot = slot;
+		s->count = 0;
+	}
+	if (++s->count > b->peak)
+		b->peak = s->count;
+}
+
+/* "uses ESMTPS TLSv1.2, cipher ECDHE-RSA-AES256-GCM-SHA384 ..." The pair is
+ * joined in a buffer on the stack, a known pair costs one lookup in the
+ * dictionary. */
+static
+void
+count_cipher(const char * ptr, struct smtp_statistics * data) {
+	char pair[CIPHER_NAME_MAX];
+	size_t proto, cipher;
+	long id;
+
+	ptr = strstr(ptr, "TLS");
+	if (ptr == NULL)
+		return;
+
+	proto = strspn(ptr, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789.");
+	if (proto >= CIPHER_NAME_MAX / 2)
+		return;
+	memcpy(pair, ptr, proto);
+	pair[proto] = ' ';
+
+	ptr += proto;
+	ptr += strspn(ptr, " ,:(");
+	if (!strncmp(ptr, "cipher", sizeof "cipher" - 1)) {
+		ptr += sizeof "cipher" - 1;
+		ptr += strspn(ptr, " :=");
+	}
+	cipher = strspn(ptr, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-");
+	if (cipher == 0 || proto + 1 + cipher >= CIPHER_NAME_MAX)
+		return;
+	memcpy(pair + proto + 1, ptr, cipher);
+
+	id = dict_find(&data->ciphers, pair, proto + 1 + cipher);
+	if (id < 0 && (long)data->ciphers.names.len < data->ciphers_max)
+		id = dict_intern(&data->ciphers, pair, proto + 1 + cipher);
+
+	if (id < 0)
+		data->ciphers_other++;
+	else
+		data->cipher_counts[id]++;
+}
+
 static
 void
 process_smtp(const char * line, struct smtp_statistics * data) {
-	char * ptr;
+	enum session_status status;
+	char * ptr, * end;
 	int val;
 
-	if (strstr(line, "tcpserver: ok")) {
+	/* multilog t labels lines by TAI64N, otherwise they are read right after
+	 * they are written. */
+	if (tai64n_parse(line, &data->now))
+		data->now = tai_now_us();
+
+	if ((ptr = strstr(line, "tcpserver: ok"))) {
 		data->sss.tcp_ok++;
+		count_burst(&data->burst, data->now);
+		if (data->event_time)
+			buckets_add(&data->events, data->now, EVENT_OK);
+		const char * addr;
+		size_t len = remote_address(ptr + sizeof "tcpserver: ok" - 1, &addr);
+		if (len) {
+			count_network(addr, len, NETWORK_OK);
+			count_client(data, addr, len);
+		}
 	} else if ((ptr = strstr(line, "tcpserver: deny"))) {
 		data->sss.tcp_deny++;
+		count_burst(&data->burst, data->now);
+		if (data->event_time)
+			buckets_add(&data->events, data->now, EVENT_DENY);
+		const char * addr;
+		size_t len = remote_address(ptr + sizeof "tcpserver: deny" - 1, &addr);
+		if (len) {
+			hitters_offer(&offenders.deny, addr, len);
+			count_network(addr, len, NETWORK_DENY);
+			count_client(data, addr, len);
+		}
 		char * rulename = 0;
 		if ((rulename = strstr(ptr, "("))) {
 			rulename++;
 			if (!rulename)
 				fprintf(stderr, "Can't extract rule name on line: %s\n", line);
 			else if (strstr(rulename, "MAXLOAD:")) {
-				update_limit(&data->ssv.maxload, rulename);
+				update_limit(&aggregated_limits.maxload, rulename);
 			}
 			else if (strstr(rulename, "MAXCONNIP:")) {
-				update_limit(&data->ssv.maxconnip, rulename);
+				update_limit(&aggregated_limits.maxconnip, rulename);
 			}
 			else if (strstr(rulename, "MAXCONNNET:")) {
-				update_limit(&data->ssv.maxconnnet, rulename);
+				update_limit(&aggregated_limits.maxconnnet, rulename);
 			}
 			else if (strstr(rulename, "MAXCONNRULE:")) {
-				update_limit(&data->ssv.maxconnrule, rulename);
+				update_limit(&aggregated_limits.maxconnrule, rulename);
 			}
 		}
 	} else if ((ptr = strstr(line, "tcpserver: status: "))) {
 		val = strtoul(ptr + sizeof "tcpserver: status: " - 1, 0, 0);
 		data->sss.tcp_status_sum += val;
 		data->sss.tcp_status_count++;
+	} else if ((ptr = strstr(line, "tcpserver: pid "))) {
+		start_session(ptr, data);
 	} else if ((ptr = strstr(line, "tcpserver: end "))) {
-		ptr = strstr(ptr, "status ");
-		if (ptr) {
-			val = strtoul(ptr + sizeof "status " - 1, 0, 0);
+		end = strstr(ptr, "status ");
+		if (end) {
+			val = strtoul(end + sizeof "status " - 1, 0, 0);
 			switch (val) {
 			case 0:
 				data->sss.tcp_end_status_0++;
+				status = SESSION_STATUS_0;
 				break;
 			case 256:
 				data->sss.tcp_end_status_256++;
+				status = SESSION_STATUS_256;
 				break;
 			case 25600:
 				data->sss.tcp_end_status_25600++;
+				status = SESSION_STATUS_25600;
 				break;
 			default:
 				data->sss.tcp_end_status_others++;
+				status = SESSION_STATUS_OTHER;
 				break;
 			}
+			end_session(ptr, status, data);
 		}
 	} else if ((ptr = strstr(line, "uses ESMTPS"))) {
 		data->sss.esmtps++;
+		count_cipher(ptr, data);
 		if (strstr(ptr, "TLSv1,")) {
 			data->sss.esmtps_tls_1++;
 		} else if (strstr(ptr, "TLSv1.1,")) {
@@ -261,6 +795,10 @@ process_smtp(const char * line, struct smtp_statistics * data) {
 		}
 	} else if ((ptr = strstr(line, "ratelimitspp:"))) {
 		if (strstr(ptr, ";Result:NOK")) {
+			char addr[INET6_ADDRSTRLEN];
+			size_t len = find_address(ptr + sizeof "ratelimitspp:" - 1, addr, sizeof addr);
+			if (len)
+				hitters_offer(&offenders.ratelimited, addr, len);
 			data->sss.ratelimitspp.ratelimited++;
 		} else if ((ptr = strstr(ptr, "Error:"))) {
 			if (strstr(ptr, "Receiving data failed, connection timed out.")) {
@@ -276,12 +814,20 @@ static
 int
 print_smtp_header(const char * name) {
 	char title[BUFSIZ];
+	char id[32];
+	int i;
 
 	sprintf(title, "Qmail SMTPD for %s", name);
 	nd_chart("qmail", name, "", "smtpd qmail", title, "# smtpd connections",
 		"smtpd", "qmail.qmail_smtpd", ND_CHART_TYPE_AREA);
 	nd_dimension("tcp_ok",   "TCP OK",   ND_ALG_ABSOLUTE,  1, 1, ND_VISIBLE);
 	nd_dimension("tcp_deny", "TCP Deny", ND_ALG_ABSOLUTE, -1, 1, ND_VISIBLE);
+	if (env_int("QMAIL_EVENT_LATENESS", -1, -1, MAX_LATENESS) >= 0) {
+		sprintf(title, "Qmail SMTPD lines later than the lateness window for %s", name);
+		nd_chart("qmail", name, "late", "late lines", title, "# lines",
+			"smtpd", "qmail.qmail_smtpd_late", ND_CHART_TYPE_LINE);
+		nd_dimension("late", "late", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	}
 	sprintf(title, "Qmail SMTPD Open Sessions for %s", name);
 	nd_chart("qmail", name, "status", "smtpd statuses", title,
 		"average # sessions", "smtpd", "qmail.qmail_smtpd_status", ND_CHART_TYPE_LINE);
@@ -334,16 +880,110 @@ print_smtp_header(const char * name) {
 	nd_dimension("perm_problem",	 "perm_problem",	 ND_ALG_ABSOLUTE,	1, 1, ND_VISIBLE);
 	nd_dimension("temp_problem",	 "temp_problem",	 ND_ALG_ABSOLUTE,	1, 1, ND_VISIBLE);
 	nd_dimension("unknown",	 "unknown",	 ND_ALG_ABSOLUTE,	1, 1, ND_VISIBLE);
+
+	sprintf(title, "Qmail SMTPD distinct clients for %s", name);
+	nd_chart("qmail", name, "clients", "distinct clients", title, "clients",
+		"smtpd", "qmail.qmail_smtpd_clients", ND_CHART_TYPE_LINE);
+	nd_dimension("tick", "update", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	nd_dimension("window", "5 minutes", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+
+	for (i = 0; i < SESSION_STATUSES; i++) {
+		sprintf(id, "session_%s", session_status_names[i]);
+		sprintf(title, "Qmail SMTPD duration of sessions ending with status %s for %s", session_status_names[i], name);
+		nd_chart("qmail", name, id, "session duration", title, "seconds",
+			"smtpd", "qmail.qmail_smtpd_session_duration", ND_CHART_TYPE_LINE);
+		nd_dimension("p50", "50th", ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+		nd_dimension("p90", "90th", ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+		nd_dimension("p99", "99th", ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+		nd_dimension("max", "Max",  ND_ALG_ABSOLUTE, 1, 1000, ND_VISIBLE);
+	}
+
+	sprintf(title, "Qmail SMTPD tls protocols and ciphers for %s", name);
+	nd_chart("qmail", name, "tls_ciphers", "tls version", title, "# tls sessions",
+		"smtpd", "qmail.qmail_smtpd_tls_ciphers", ND_CHART_TYPE_STACKED);
+	nd_dimension("other", "other", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+
+	sprintf(title, "Qmail SMTPD peak connection rate in 100 ms for %s", name);
+	nd_chart("qmail", name, "burst", "connection bursts", title, "connections/s",
+		"smtpd", "qmail.qmail_smtpd_burst", ND_CHART_TYPE_LINE);
+	nd_dimension("peak", "peak", ND_ALG_ABSOLUTE, BURST_SLOTS_PER_SECOND, 1, ND_VISIBLE);
+	nd_dimension("average", "average", ND_ALG_ABSOLUTE, 1, FRACTIONAL_CONVERSION, ND_VISIBLE);
+
+	sprintf(title, "Qmail SMTPD connection burstiness for %s", name);
+	nd_chart("qmail", name, "burstiness", "connection bursts", title, "peak/average",
+		"smtpd", "qmail.qmail_smtpd_burstiness", ND_CHART_TYPE_LINE);
+	nd_dimension("ratio", "ratio", ND_ALG_ABSOLUTE, 1, FRACTIONAL_CONVERSION, ND_VISIBLE);
 	return fflush(stdout);
 }
 
 static
-int
-print_smtp_data(const char * name, const struct smtp_statistics * data, const unsigned long time) {
+void
+cipher_id(char * id, const char * name) {
+	for (; *name; name++, id++)
+		*id = *name == '.' || *name == ' ' ? '_' : *name;
+	*id = '\0';
+}
+
+/* New pairs are announced by repeating the chart with their dimensions only */
+static
+void
+print_ciphers(const char * name, const struct smtp_statistics * data, const unsigned long time) {
+	char id[CIPHER_NAME_MAX];
+	char title[BUFSIZ];
+	const char * pair;
+	int i;
+
+	if (data->ciphers_shown < data->ciphers_announced) {
+		sprintf(title, "Qmail SMTPD tls protocols and ciphers for %s", name);
+		nd_chart("qmail", name, "tls_ciphers", "tls version", title, "# tls sessions",
+			"smtpd", "qmail.qmail_smtpd_tls_ciphers", ND_CHART_TYPE_STACKED);
+		for (i = data->ciphers_shown; i < data->ciphers_announced; i++) {
+			pair = dict_name(&data->ciphers, i);
+			cipher_id(id, pair);
+			nd_dimension(id, pair, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		}
+	}
+
+	nd_begin_time("qmail", name, "tls_ciphers", time);
+	for (i = 0; i < data->ciphers_announced; i++) {
+		cipher_id(id, dict_name(&data->ciphers, i));
+		nd_set(id, data->cipher_counts[i]);
+	}
+	nd_set("other", data->ciphers_other);
+	nd_end();
+}
+
+/* One closed bucket of the main chart, time is its width */
+static
+void
+print_connections(const long * row, unsigned long time, const char * name) {
 	nd_begin_time("qmail", name, "", time);
-	nd_set("tcp_ok", data->sss.tcp_ok);
-	nd_set("tcp_deny", data->sss.tcp_deny);
+	nd_set("tcp_ok", row[EVENT_OK]);
+	nd_set("tcp_deny", row[EVENT_DENY]);
 	nd_end();
+}
+
+static
+int
+print_smtp_data(const char * name, const struct smtp_statistics * data, const unsigned long time) {
+	const struct histogram * h;
+	const struct burst * b;
+	uint64_t span;
+	char id[32];
+	int i;
+
+	if (data->event_time) {
+		buckets_emit(&data->events,
+			(void (*)(const long *, unsigned long, void *))&print_connections, (void *)name);
+		nd_begin_time("qmail", name, "late", time);
+		nd_set("late", data->events.late);
+		nd_end();
+	} else {
+		nd_begin_time("qmail", name, "", time);
+		nd_set("tcp_ok", data->sss.tcp_ok);
+		nd_set("tcp_deny", data->sss.tcp_deny);
+		nd_end();
+	}
 
 	nd_begin_time("qmail", name, "status", time);
 	nd_set("tcp_status_average", data->sss.tcp_status);
@@ -392,53 +1032,76 @@ print_smtp_data(const char * name, const struct smtp_statistics * data, const un
 	nd_set("perm_problem", data->sss.queue_err_perm_problem);
 	nd_set("temp_problem", data->sss.queue_err_temp_problem);
 	nd_end();
+
+	nd_begin_time("qmail", name, "clients", time);
+	nd_set("tick", hll_estimate(&data->clients.tick));
+	nd_set("window", hll_window_estimate(&data->clients));
+	nd_end();
+
+	/* Values are left empty in ticks without ended sessions */
+	for (i = 0; i < SESSION_STATUSES; i++) {
+		h = &data->duration[i];
+		sprintf(id, "session_%s", session_status_names[i]);
+		nd_begin_time("qmail", name, id, time);
+		if (h->total) {
+			nd_set("p50", histogram_percentile(h, 500));
+			nd_set("p90", histogram_percentile(h, 900));
+			nd_set("p99", histogram_percentile(h, 990));
+			nd_set("max", h->max);
+		}
+		nd_end();
+	}
+
+	print_ciphers(name, data, time);
+
+	/* The average is taken over the span of the tick's lines, at least one
+	 * second, so the ratio is 1 for evenly spread connections and 10 when
+	 * one second of them came in 100 ms. */
+	b = &data->burst;
+	span = b->events ? b->last - b->first + 1 : 0;
+	span = span < BURST_SLOTS_PER_SECOND ? BURST_SLOTS_PER_SECOND : span;
+	nd_begin_time("qmail", name, "burst", time);
+	nd_set("peak", b->peak);
+	nd_set("average", (long)b->events * BURST_SLOTS_PER_SECOND * FRACTIONAL_CONVERSION / span);
+	nd_end();
+
+	nd_begin_time("qmail", name, "burstiness", time);
+	if (b->events)
+		nd_set("ratio", (long)b->peak * span * FRACTIONAL_CONVERSION / b->events);
+	nd_end();
 	return fflush(stdout);
 }
 
 static
 void
-clear_limits(struct vector * limit) {
-	struct limit_t * l = 0;
-	for (int i = 0; i < limit->len; i++) {
-		l = vector_item(limit, i);
-		l->count = 0;
+clear_limits(struct table * limit) {
+	struct limit_t * l;
+	size_t i;
+
+	for (i = 0; i < limit->cap; i++) {
+		if (limit->keys[i]) {
+			l = table_item(limit, i);
+			l->count = 0;
+		}
 	}
 }
 
 static
 void
 clear_smtp_data(struct smtp_statistics * data) {
+	int i;
 	int tmp = data->sss.tcp_status;
 	memset(&data->sss, 0, sizeof data->sss);
 	data->sss.tcp_status = tmp;
-	clear_limits(&data->ssv.maxload);
-	clear_limits(&data->ssv.maxconnip);
-	clear_limits(&data->ssv.maxconnnet);
-	clear_limits(&data->ssv.maxconnrule);
-}
-
-static
-void
-postprocess_limits(struct vector * limit_aggregated, struct vector * limit) {
-	struct limit_t * l = 0;
-	struct limit_t * l_a = 0;
-
-	for (int i = 0; i < limit->len; i++) {
-		l = vector_item(limit, i);
-		int found = 0;
-		for (int i_a = 0; i_a < limit_aggregated->len; i_a++) {
-			l_a = vector_item(limit_aggregated, i_a);
-			if (!strcmp(l->rulename, l_a->rulename)) {
-				l_a->count += l->count;
-				found = 1;
-				break;
-			}
-		}
-		if (!found) {
-			l->new = 1;
-			vector_add(limit_aggregated, l);
-		}
-	}
+	hll_clear(&data->clients.tick);
+	hll_window_advance(&data->clients);
+	for (i = 0; i < SESSION_STATUSES; i++)
+		histogram_clear(&data->duration[i]);
+	data->burst.peak = 0;
+	data->burst.events = 0;
+	memset(data->cipher_counts, 0, data->ciphers.names.len * sizeof * data->cipher_counts);
+	data->ciphers_other = 0;
+	data->events.late = 0;
 }
 
 static
@@ -452,20 +1115,32 @@ postprocess_data(struct smtp_statistics * data) {
 	if (data->sss.ratelimitspp.ratelimited)
 		aggregated_ratelimtspp.ratelimited = 1;
 
-	postprocess_limits(&aggregated_limits.maxload, &data->ssv.maxload);
-	postprocess_limits(&aggregated_limits.maxconnip, &data->ssv.maxconnip);
-	postprocess_limits(&aggregated_limits.maxconnnet, &data->ssv.maxconnnet);
-	postprocess_limits(&aggregated_limits.maxconnrule, &data->ssv.maxconnrule);
+	hll_window_merge(&aggregated_clients.window, &data->clients);
+
+	/* Pairs seen during the tick become dimensions in the print */
+	data->ciphers_shown = data->ciphers_announced;
+	data->ciphers_announced = data->ciphers.names.len;
+
+	if (data->event_time)
+		buckets_close(&data->events, tai_now_us());
+
+	if (data->now)
+		wheel_expire(&data->session_wheel, data->now,
+			(void (*)(uint64_t, uint64_t, void *))&expire_session, data);
 }
 
 static
 void
 finish (struct smtp_statistics * data) {
-	vector_free(&data->ssv.maxconnnet);
-	vector_free(&data->ssv.maxconnip);
-	vector_free(&data->ssv.maxconnrule);
-	vector_free(&data->ssv.maxload);
+	if (data->event_time)
+		buckets_free(&data->events);
+	free(data->cipher_counts);
+	dict_free(&data->ciphers);
+	wheel_free(&data->session_wheel);
+	table_free(&data->sessions);
 	free(data);
+	if (--smtp_watchers == 0)
+		aggregated_free();
 }
 
 static
@@ -485,14 +1160,23 @@ struct stat_func * smtp_func = &smtp;
 void
 ratelimitspp_clear() {
 	memset(&aggregated_ratelimtspp, 0, sizeof aggregated_ratelimtspp);
+	if (smtp_watchers)
+		hitters_clear(&offenders.ratelimited);
 }
 
 void
 tcpserverlimits_clear() {
+	if (!smtp_watchers)
+		return;
 	clear_limits(&aggregated_limits.maxload);
 	clear_limits(&aggregated_limits.maxconnip);
 	clear_limits(&aggregated_limits.maxconnnet);
 	clear_limits(&aggregated_limits.maxconnrule);
+	hitters_clear(&offenders.deny);
+	hll_clear(&aggregated_clients.window.tick);
+	hll_window_advance(&aggregated_clients.window);
+	trie_clear(&networks.v4.trie);
+	trie_clear(&networks.v6.trie);
 }
 
 int
@@ -504,6 +1188,22 @@ ratelimitspp_print_hdr() {
 	return fflush(stdout);
 }
 
+/* The heavy hitters are charted every tick, the set of dimensions follows the
+ * biggest offenders of the tick. */
+static
+void
+print_offenders(struct hitters * h, struct topn * top, const char * id, const char * title,
+		const char * context, const unsigned long time) {
+	size_t i;
+
+	topn_clear(top);
+	for (i = 0; i < h->len; i++)
+		topn_offer(top, h->heap[i].name, strlen(h->heap[i].name), h->heap[i].count);
+	topn_update(top);
+
+	topn_print(top, "qmail", "offenders", id, title, "lines", "offenders", context, time);
+}
+
 int
 ratelimitspp_print(const unsigned long time) {
 	nd_begin_time("qmail", "ratelimitspp", "events", time);
@@ -511,59 +1211,160 @@ ratelimitspp_print(const unsigned long time) {
 	nd_set("error", aggregated_ratelimtspp.error);
 	nd_set("ratelimited", aggregated_ratelimtspp.ratelimited);
 	nd_end();
+
+	if (smtp_watchers) {
+		print_offenders(&offenders.ratelimited, &offenders.top_ratelimited, "ratelimitspp",
+			"Qmail ratelimitspp clients with Result:NOK", "qmail.smtpd_offenders_ratelimitspp", time);
+		offenders.ratelimited_error = hitters_error(&offenders.ratelimited);
+	}
 	return fflush(stdout);
 }
 
+/* New rules are announced by repeating the chart with their dimensions only,
+ * then all rules are set in one update. */
 static
 void
-print_limits(struct vector * limit, const char * limit_name, const unsigned long time) {
+print_limits(struct table * limit, const char * limit_name, const unsigned long time) {
+	char title[BUFSIZ];
+	const char * name;
 	struct limit_t * l;
+	int announced = 0;
+	size_t i;
 
-	struct vector newdim;
-	vector_init(&newdim, sizeof(struct limit_t));
+	if (!limit->len)
+		return;
 
-	for (int i = 0; i < limit->len; i++) {
-		l = vector_item(limit, i);
-		if (l->new) {
-			vector_add(&newdim, l);
+	for (i = 0; i < limit->cap; i++) {
+		if (!limit->keys[i])
+			continue;
+		l = table_item(limit, i);
+		if (!l->new)
+			continue;
+		if (!announced) {
+			sprintf(title, "Qmail SMTPD %s limit", limit_name);
+			nd_chart("qmail", "limit", limit_name, "", title, "# reaches",
+				"tcpserver", "qmail.qmail_smtpd_limits", ND_CHART_TYPE_LINE);
+			announced = 1;
 		}
+		name = dict_name(&rulenames, limit->keys[i] - 1);
+		nd_dimension(name, name, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		l->new = 0;
 	}
 
-	if (limit->len > newdim.len) {
-		nd_begin_time("qmail", "limit", limit_name, time);
-		for (int i = 0; i < limit->len; i++) {
-			l = vector_item(limit, i);
-			if (l->new) {
-				l->new = 0;
-			} else {
-				nd_set(l->rulename, l->count);
-			}
+	nd_begin_time("qmail", "limit", limit_name, time);
+	for (i = 0; i < limit->cap; i++) {
+		if (limit->keys[i]) {
+			l = table_item(limit, i);
+			nd_set(dict_name(&rulenames, limit->keys[i] - 1), l->count);
 		}
-		nd_end();
 	}
+	nd_end();
+}
 
-	for (int i = 0; i < newdim.len; i++) {
-		l = vector_item(&newdim, i);
-		char title[BUFSIZ];
-		sprintf(title, "Qmail SMTPD %s limit", limit_name);
-		nd_chart("qmail", "limit", limit_name, "", title, "# reaches",
-			"tcpserver", "qmail.qmail_smtpd_limits", ND_CHART_TYPE_LINE);
-		nd_dimension(l->rulename, l->rulename,     ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+struct network_visit {
+	const struct network_family * family;
+	unsigned length;
+	struct topn * top;
+};
 
-		nd_begin_time("qmail", "limit", limit_name, time);
-		nd_set(l->rulename, l->count);
-		nd_end();
-		if (limit->len == newdim.len) {
-			l = vector_item(limit, i);
-			l->new = 0;
-		}
-	}
-	vector_free(&newdim);
+static
+void
+offer_network(const uint8_t * prefix, const uint32_t * count, void * data) {
+	const struct network_visit * v = data;
+	char name[INET6_ADDRSTRLEN + sizeof "/128"];
+	size_t len;
 
+	if (inet_ntop(v->family->af, prefix, name, INET6_ADDRSTRLEN) == NULL)
+		return;
+	len = strlen(name);
+	len += sprintf(name + len, "/%u", v->length);
+
+	if (count[NETWORK_DENY])
+		topn_offer(&v->top[NETWORK_DENY], name, len, count[NETWORK_DENY]);
+	if (count[NETWORK_OK])
+		topn_offer(&v->top[NETWORK_OK], name, len, count[NETWORK_OK]);
+}
+
+/* Networks of each prefix length are collected by one walk of the trie down
+ * to that length. */
+static
+void
+print_networks(struct network_family * f, const unsigned long time) {
+	struct network_visit visit;
+	char title[BUFSIZ];
+	char id[32];
+	int i;
+
+	for (i = 0; i < f->count; i++) {
+		visit.family = f;
+		visit.length = f->lengths[i];
+		visit.top = f->top[i];
+		topn_clear(&f->top[i][NETWORK_DENY]);
+		topn_clear(&f->top[i][NETWORK_OK]);
+		trie_walk(&f->trie, f->lengths[i], offer_network, &visit);
+		topn_update(&f->top[i][NETWORK_DENY]);
+		topn_update(&f->top[i][NETWORK_OK]);
+
+		sprintf(id, "deny%s_%u", f->suffix, f->lengths[i]);
+		sprintf(title, "Qmail tcpserver denies by /%u IPv%s networks", f->lengths[i], f->af == AF_INET ? "4" : "6");
+		topn_print(&f->top[i][NETWORK_DENY], "qmail", "networks", id, title, "denies",
+			"networks", "qmail.smtpd_networks_deny", time);
+
+		sprintf(id, "ok%s_%u", f->suffix, f->lengths[i]);
+		sprintf(title, "Qmail tcpserver connections by /%u IPv%s networks", f->lengths[i], f->af == AF_INET ? "4" : "6");
+		topn_print(&f->top[i][NETWORK_OK], "qmail", "networks", id, title, "connections",
+			"networks", "qmail.smtpd_networks_ok", time);
+	}
 }
 
 int
 tcpserverlimits_print(const unsigned long time) {
+	if (!smtp_watchers)
+		return fflush(stdout);
+
+	print_offenders(&offenders.deny, &offenders.top_deny, "deny",
+		"Qmail tcpserver clients with deny", "qmail.smtpd_offenders_deny", time);
+
+	/* Any count above may be overestimated by at most this value */
+	if (!offenders.hdr_printed) {
+		nd_chart("qmail", "offenders", "error", "", "Qmail offender counts error bound", "lines",
+			"offenders", "qmail.smtpd_offenders_error", ND_CHART_TYPE_LINE);
+		nd_dimension("deny", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		nd_dimension("ratelimitspp", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		offenders.hdr_printed = 1;
+	}
+	nd_begin_time("qmail", "offenders", "error", time);
+	nd_set("deny", hitters_error(&offenders.deny));
+	nd_set("ratelimitspp", offenders.ratelimited_error);
+	nd_end();
+
+	if (!aggregated_clients.hdr_printed) {
+		nd_chart("qmail", "clients", NULL, NULL, "Qmail SMTPD distinct clients of all instances", "clients",
+			"smtpd", "qmail.smtpd_clients", ND_CHART_TYPE_LINE);
+		nd_dimension("tick", "update", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		nd_dimension("window", "5 minutes", ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		aggregated_clients.hdr_printed = 1;
+	}
+	nd_begin_time("qmail", "clients", NULL, time);
+	nd_set("tick", hll_estimate(&aggregated_clients.window.tick));
+	nd_set("window", hll_window_estimate(&aggregated_clients.window));
+	nd_end();
+
+	print_networks(&networks.v4, time);
+	print_networks(&networks.v6, time);
+
+	/* Addresses which did not fit into the node pool */
+	if (!networks.hdr_printed) {
+		nd_chart("qmail", "networks", "dropped", "", "Qmail client addresses not aggregated by network", "addresses",
+			"networks", "qmail.smtpd_networks_dropped", ND_CHART_TYPE_LINE);
+		nd_dimension("ipv4", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		nd_dimension("ipv6", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		networks.hdr_printed = 1;
+	}
+	nd_begin_time("qmail", "networks", "dropped", time);
+	nd_set("ipv4", networks.v4.trie.dropped);
+	nd_set("ipv6", networks.v6.trie.dropped);
+	nd_end();
 	print_limits(&aggregated_limits.maxload, "maxload", time);
 	print_limits(&aggregated_limits.maxconnip, "maxconnip", time);
 	print_limits(&aggregated_limits.maxconnrule, "maxconnrule", time);
@@ -4,16 +4,28 @@
 #include <endian.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "cnproc.h"
+#include "env.h"
 #include "err.h"
+#include "flush.h"
 #include "netdata.h"
+#include "proc.h"
+#include "signal.h"
+#include "table.h"
 #include "timer.h"
 #include "vector.h"
 
@@ -21,6 +33,10 @@
 
 #define DEFAULT_PATH "/service"
 
+/* Only the first 18 bytes are written by supervise. The pid is stored in
+ * little endian, the timestamp is TAI64 in big endian. */
+#define DT_STAT_SIZE 18
+
 struct dt_stat {
 	uint64_t seconds;
 	uint32_t nano;
@@ -36,17 +52,127 @@ enum status {
 	ERR_READ,
 };
 
+/* Restarts are counted in a ring of RESTART_SLOT second slots covering the
+ * longest window. Sums of both windows are kept up to date as the ring
+ * advances, so recording and reading of a rate costs O(1). */
+#define RESTART_SLOT 5
+#define RESTART_SLOTS_1M (60 / RESTART_SLOT)
+#define RESTART_SLOTS_10M (600 / RESTART_SLOT)
+
+struct restarts {
+	uint64_t total;
+	uint64_t slot;           /* current slot, monotonic time / RESTART_SLOT */
+	uint32_t sum_1m;
+	uint32_t sum_10m;
+	uint16_t count[RESTART_SLOTS_10M];
+};
+
+/* Exit codes and signals of a service get their own dimensions up to
+ * EXIT_REASONS of them, further ones are counted as other. */
+#define EXIT_REASONS 8
+
+struct exit_reason {
+	int status;       /* exit code, or minus the signal */
+	uint32_t count;   /* exits in the tick */
+};
+
+/* The status is cached and read again only if supervise replaced it, which is
+ * reported by inotify on the supervise directory. Services whose directory
+ * cannot be watched are read every tick. */
 struct statistics {
 	struct {
 		uint64_t timestamp;
+		uint32_t pid;
 		int is_up;
 		char want;
 		enum status err;
 	} data;
+	struct restarts restarts;
+	struct {
+		uint64_t clean;  /* exit code 0 */
+		uint64_t error;  /* nonzero exit code */
+		uint64_t signal; /* killed by a signal */
+	} exits;
+	struct {
+		struct exit_reason list[EXIT_REASONS];
+		int len;
+		int announced;   /* reasons with a dimension */
+		uint32_t other;
+	} reasons;
+	int has_status;   /* the status was read at least once */
+	struct proc_fds proc;    /* /proc of the supervised process */
+	struct vector children;  /* proc_fds of its children sorted by pid */
+	struct proc_usage usage;
+	int has_usage;
+	struct {
+		int dir;          /* O_PATH descriptor of multilog directory */
+		int file;         /* O_PATH descriptor of its current file */
+		ino_t ino;
+		off_t size;       /* size of current when it was read last time */
+		uint64_t bytes;   /* bytes written since start of the plugin */
+	} log;
+	int has_log;
 	const char * name;
+	int supervise_fd; /* O_PATH descriptor of supervise directory */
+	int watch;        /* inotify watch of supervise directory */
+	int dirty;        /* status has to be read again */
+	int removed;      /* the service directory disappeared */
+	int seen;         /* the service was found by the last scan */
 };
 
-int run;
+static
+const struct {
+	const char * id;
+	const char * title;
+	const char * units;
+	const char * context;
+	enum nd_algorithm algorithm;
+	int exits;        /* needs the proc connector */
+} charts[] = {
+	{ "uptime",      "Service Uptime",                    "seconds",    "daemontools.uptime",      ND_ALG_ABSOLUTE },
+	{ "downtime",    "Service Downtime",                  "seconds",    "daemontools.downtime",    ND_ALG_ABSOLUTE },
+	{ "up_down",     "Service Up/Down",                   "up/down",    "daemontools.up_down",     ND_ALG_ABSOLUTE },
+	{ "restarts",    "Service Restarts",                  "restarts/s", "daemontools.restarts",    ND_ALG_INCREMENTAL },
+	{ "restarts_1m", "Service Restarts in Last Minute",   "restarts",   "daemontools.restarts_1m", ND_ALG_ABSOLUTE },
+	{ "restarts_10m", "Service Restarts in Last 10 Minutes", "restarts", "daemontools.restarts_10m", ND_ALG_ABSOLUTE },
+	{ "cpu",         "Service CPU",                       "percentage", "daemontools.cpu",         ND_ALG_INCREMENTAL },
+	{ "memory",      "Service Resident Memory",           "KiB",        "daemontools.memory",      ND_ALG_ABSOLUTE },
+	{ "threads",     "Service Threads",                   "threads",    "daemontools.threads",     ND_ALG_ABSOLUTE },
+	{ "fds",         "Service Open Files",                "files",      "daemontools.fds",         ND_ALG_ABSOLUTE },
+	{ "log",         "Service Log Throughput",            "bytes/s",    "daemontools.log",         ND_ALG_INCREMENTAL },
+	{ "exits_clean", "Service Clean Exits",               "exits/s",    "daemontools.exits_clean", ND_ALG_INCREMENTAL, 1 },
+	{ "exits_error", "Service Exits with Error",          "exits/s",    "daemontools.exits_error", ND_ALG_INCREMENTAL, 1 },
+	{ "exits_signal", "Service Exits by Signal",          "exits/s",    "daemontools.exits_signal", ND_ALG_INCREMENTAL, 1 },
+};
+
+/* Upper bound of children whose usage is added to the service, e.g. the
+ * qmail-smtpd processes of tcpserver. */
+#define MAX_CHILDREN 4096
+
+/* Children of all services read through kept descriptors, each takes four of
+ * them. Further children are read by one shot opens. */
+#define MAX_CHILD_HANDLES 128
+
+#define LEN(x) ( sizeof x / sizeof * x )
+
+static long clock_ticks;
+static long page_size;
+static int child_handles;
+
+/* multilog directory of a service, relative to the service directory */
+#define DEFAULT_LOG_DIR "log/main"
+
+/* Services by pid of the supervised process, the value is the index of the
+ * service. It is used only with the proc connector. */
+static struct table services_by_pid = TABLE_EMPTY;
+
+enum poll {
+	POLL_SIGNAL = 0,
+	POLL_TIMER,
+	POLL_FS_EVENT,
+	POLL_CNPROC,
+	POLL_LENGTH
+};
 
 static
 void
@@ -62,59 +188,901 @@ tai_now() {
 
 static
 void
-quit(int unused) {
-	run = 0;
+open_supervise(struct statistics * statistics, const int fs_event_fd) {
+	const char * dir = statistics->name;
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof path, "%s/supervise", dir);
+	statistics->supervise_fd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (statistics->supervise_fd == -1) {
+		/* A new service gets its supervise directory within seconds, do not
+		 * repeat the message until then. */
+		if (statistics->data.err != ERR_CHDIR)
+			fprintf(stderr, "Cannot open directory '%s': %s\n", path, strerror(errno));
+		statistics->data.err = ERR_CHDIR;
+		return;
+	}
+
+	/* supervise writes status.new and renames it to status */
+	statistics->watch = inotify_add_watch(fs_event_fd, path, IN_MOVED_TO | IN_CLOSE_WRITE);
+	if (statistics->watch == -1)
+		fprintf(stderr, "Cannot watch '%s', it is read every time: %s\n", path, strerror(errno));
+}
+
+static
+void
+close_supervise(struct statistics * statistics, const int fs_event_fd) {
+	if (statistics->watch != -1)
+		inotify_rm_watch(fs_event_fd, statistics->watch);
+	if (statistics->supervise_fd != -1)
+		close(statistics->supervise_fd);
+	statistics->watch = -1;
+	statistics->supervise_fd = -1;
 }
 
+static
 void
-collect_uptime(struct statistics * statistics) {
-	const char * dir = statistics->name;
-	unsigned char status[18]; /* See daemontools code */
-	struct dt_stat * stat;
-	int fd, ret;
+close_log(struct statistics * statistics) {
+	if (statistics->log.file != -1)
+		close(statistics->log.file);
+	if (statistics->log.dir != -1)
+		close(statistics->log.dir);
+	statistics->log.file = -1;
+	statistics->log.dir = -1;
+	statistics->has_log = 0;
+}
 
-	if (chdir(dir) == -1) {
-		fprintf(stderr, "Cannot change directory to '%s': %s\n", dir, strerror(errno));
-		statistics->data.err = ERR_CHDIR;
+static
+void
+close_children(struct statistics * statistics) {
+	struct proc_fds * p;
+	int i;
+
+	for (i = 0; i < statistics->children.len; i++) {
+		p = vector_item(&statistics->children, i);
+		proc_close(p);
+		child_handles--;
+	}
+	statistics->children.len = 0;
+}
+
+static
+void
+restarts_advance(struct restarts * r) {
+	struct timespec now;
+	uint64_t slot;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	slot = now.tv_sec / RESTART_SLOT;
+
+	if (slot - r->slot >= RESTART_SLOTS_10M) {
+		memset(r->count, 0, sizeof r->count);
+		r->sum_1m = 0;
+		r->sum_10m = 0;
+		r->slot = slot;
 		return;
 	}
 
-	fd = open("supervise/status", O_RDONLY | O_NDELAY);
+	while (r->slot < slot) {
+		r->slot++;
+		r->sum_1m -= r->count[(r->slot - RESTART_SLOTS_1M) % RESTART_SLOTS_10M];
+		r->sum_10m -= r->count[r->slot % RESTART_SLOTS_10M];
+		r->count[r->slot % RESTART_SLOTS_10M] = 0;
+	}
+}
+
+static
+void
+restarts_record(struct restarts * r) {
+	restarts_advance(r);
+	r->count[r->slot % RESTART_SLOTS_10M]++;
+	r->sum_1m++;
+	r->sum_10m++;
+	r->total++;
+}
+
+void
+collect_uptime(struct statistics * statistics) {
+	const char * dir = statistics->name;
+	struct dt_stat stat;
+	int fd, ret;
+
+	fd = openat(statistics->supervise_fd, "status", O_RDONLY | O_NDELAY | O_CLOEXEC);
 	if (fd == -1) {
 		fprintf(stderr, "Cannot open %s/supervise/status: %s\n", dir, strerror(errno));
 		statistics->data.err = ERR_OPEN;
 		return;
 	}
 
-	ret = read(fd, status, sizeof status);
+	ret = read(fd, &stat, DT_STAT_SIZE);
 	close(fd);
 
-	if (ret < sizeof status) {
-		fprintf(stderr, "Cannot read supervise/status\n");
+	if (ret < DT_STAT_SIZE) {
+		fprintf(stderr, "Cannot read %s/supervise/status\n", dir);
 		statistics->data.err = ERR_READ;
 		return;
 	}
 
-	stat = (void *)status;
-	statistics->data.timestamp = be64toh(stat->seconds);
-	statistics->data.is_up = !!stat->pid;
-	statistics->data.want = stat->want;
+	/* The service was started since the last read if it runs under a new pid
+	 * or with a new timestamp. Status changes are read as inotify reports
+	 * them, so even restarts between ticks are counted. */
+	if (statistics->has_status && stat.pid
+			&& (le32toh(stat.pid) != statistics->data.pid || be64toh(stat.seconds) != statistics->data.timestamp))
+		restarts_record(&statistics->restarts);
+
+	statistics->has_status = 1;
+	statistics->data.timestamp = be64toh(stat.seconds);
+	statistics->data.pid = le32toh(stat.pid);
+	statistics->data.is_up = !!stat.pid;
+	statistics->data.want = stat.want;
 	statistics->data.err = SUCCESS;
+	statistics->dirty = statistics->watch == -1;
+}
+
+/* The dimension of one service is announced (or made obsolete) by repeating
+ * the chart definition with the single dimension. Without a service all
+ * dimensions are printed. */
+static
+void
+print_charts(struct vector * directories, const struct statistics * only, const enum nd_visibility visibility) {
+	const struct statistics * st;
+	int c, i;
+
+	for (c = 0; c < LEN(charts); c++) {
+		if (charts[c].exits && !table_is_init(&services_by_pid))
+			continue;
+		nd_chart("daemontools", charts[c].id, NULL, NULL, charts[c].title, charts[c].units,
+			"daemontools", charts[c].context, ND_CHART_TYPE_LINE);
+		if (only) {
+			nd_dimension(only->name, only->name, charts[c].algorithm, 1, 1, visibility);
+			continue;
+		}
+		for (i = 0; i < directories->len; i++) {
+			st = vector_item(directories, i);
+			if (!st->removed)
+				nd_dimension(st->name, st->name, charts[c].algorithm, 1, 1, visibility);
+		}
+	}
+}
+
+static
+struct statistics *
+find_service(struct vector * directories, const char * name) {
+	struct statistics * st;
+	int i;
+
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (!strcmp(st->name, name))
+			return st;
+	}
+
+	return NULL;
+}
+
+static
+struct statistics *
+find_removed(struct vector * directories) {
+	struct statistics * st;
+	int i;
+
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (st->removed)
+			return st;
+	}
+
+	return NULL;
+}
+
+static
+void
+init_service(struct statistics * st, const char * name, const struct vector children) {
+	memset(st, 0, sizeof * st);
+	st->supervise_fd = -1;
+	st->watch = -1;
+	st->dirty = 1;
+	st->seen = 1;
+	st->proc = (struct proc_fds)PROC_FDS_EMPTY;
+	st->children = children;
+	st->log.dir = -1;
+	st->log.file = -1;
+	st->name = name;
+}
+
+/* A removed service keeps its slot and counters while it may come back, the
+ * slot is given to a new service otherwise. So the vector does not grow with
+ * every name ever seen, e.g. with services created per client address. */
+static
+void
+add_service(struct vector * directories, const char * name, const int announce) {
+	struct statistics statistics;
+	struct statistics * st;
+	char * copy;
+
+	if (name[0] == '.' || is_directory(name) != 1)
+		return;
+
+	st = find_service(directories, name);
+	if (st) {
+		st->seen = 1;
+		if (!st->removed)
+			return;
+		st->removed = 0;
+		st->dirty = 1;
+	} else {
+		copy = strdup(name);
+		if (copy == NULL)
+			return;
+		st = find_removed(directories);
+		if (st) {
+			free((void *)st->name);
+			init_service(st, copy, st->children);
+		} else {
+			init_service(&statistics, copy, (struct vector)VECTOR_EMPTY);
+			if (vector_add(directories, &statistics) != ND_SUCCESS) {
+				free(copy);
+				return;
+			}
+			st = vector_item(directories, directories->len - 1);
+		}
+	}
+
+	if (announce) {
+		fprintf(stderr, "Service detected: %s\n", name);
+		print_charts(directories, st, ND_VISIBLE);
+	}
+}
+
+/* The table follows the pid read from the status. The exit is reported by the
+ * kernel before supervise is woken up, so the proc connector is read first and
+ * the old pid is still known when its exit comes. */
+static
+void
+track_pid(const uint32_t old, const uint32_t pid, const int idx) {
+	int * value;
+
+	if (!table_is_init(&services_by_pid))
+		return;
+
+	if (old)
+		table_remove(&services_by_pid, old);
+	if (pid && (value = table_insert(&services_by_pid, pid)))
+		*value = idx;
+}
+
+static
+void
+remove_service(struct statistics * st, const int fs_event_fd) {
+	if (st->removed)
+		return;
+
+	fprintf(stderr, "Service removed: %s\n", st->name);
+	close_supervise(st, fs_event_fd);
+	proc_close(&st->proc);
+	close_children(st);
+	close_log(st);
+	st->has_usage = 0;
+	track_pid(st->data.pid, 0, -1);
+	st->data.err = ERR_CHDIR;
+	st->removed = 1;
+	print_charts(NULL, st, ND_OBSOLETE);
+}
+
+static
+void
+scan_services(struct vector * directories, const int fs_event_fd, const int announce) {
+	struct dirent * dir_entry;
+	struct statistics * st;
+	DIR * dir;
+	int i;
+
+	dir = opendir(".");
+	if (dir == NULL) {
+		fprintf(stderr, "Cannot open service directory: %s\n", strerror(errno));
+		return;
+	}
+
+	for (i = 0; i < directories->len; i++)
+		((struct statistics *)vector_item(directories, i))->seen = 0;
+
+	while ((dir_entry = readdir(dir)))
+		add_service(directories, dir_entry->d_name, announce);
+	closedir(dir);
+
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (!st->seen)
+			remove_service(st, fs_event_fd);
+	}
+}
+
+static
+void
+process_service_event(const struct inotify_event * event, struct vector * directories, const int fs_event_fd) {
+	struct statistics * st;
+
+	if (!event->len || event->name[0] == '.')
+		return;
+
+	if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+		add_service(directories, event->name, 1);
+	} else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+		st = find_service(directories, event->name);
+		if (st)
+			remove_service(st, fs_event_fd);
+	}
+}
+
+static
+void
+process_status_events(const int fs_event_fd, const int root_watch, struct vector * directories) {
+	const struct inotify_event * event;
+	struct statistics * st;
+	char buf[BUFSIZ];
+	ssize_t len;
+	char * ptr;
+	int i;
+
+	while ((len = read(fs_event_fd, buf, sizeof buf)) > 0) {
+		for (ptr = buf; ptr < buf + len; ptr += sizeof * event + event->len) {
+			event = (const struct inotify_event *)ptr;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				for (i = 0; i < directories->len; i++)
+					((struct statistics *)vector_item(directories, i))->dirty = 1;
+				scan_services(directories, fs_event_fd, 1);
+				continue;
+			}
+
+			if (event->wd == root_watch) {
+				process_service_event(event, directories, fs_event_fd);
+				continue;
+			}
+
+			for (i = 0; i < directories->len; i++) {
+				st = vector_item(directories, i);
+				if (event->wd == st->watch) {
+					/* The directory was removed, e.g. svc -x */
+					if (event->mask & IN_IGNORED) {
+						st->watch = -1;
+						close_supervise(st, fs_event_fd);
+					}
+					if (!event->len || !strcmp(event->name, "status"))
+						st->dirty = 1;
+					break;
+				}
+			}
+		}
+	}
+
+	if (len == -1 && errno != EAGAIN)
+		fprintf(stderr, "Cannot read fs_event fd: %s\n", strerror(errno));
+}
+
+static
+void
+collect_services(struct vector * directories, const int fs_event_fd) {
+	struct statistics * st;
+	uint32_t pid;
+	int i;
+
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (st->removed)
+			continue;
+		if (st->supervise_fd == -1)
+			open_supervise(st, fs_event_fd);
+		if (st->supervise_fd != -1 && st->dirty) {
+			pid = st->data.pid;
+			collect_uptime(st);
+			if (st->data.pid != pid)
+				track_pid(pid, st->data.pid, i);
+		}
+	}
+}
+
+static
+void
+count_exit_reason(struct statistics * st, const int status) {
+	int i;
+
+	for (i = 0; i < st->reasons.len; i++) {
+		if (st->reasons.list[i].status == status) {
+			st->reasons.list[i].count++;
+			return;
+		}
+	}
+
+	if (st->reasons.len < EXIT_REASONS) {
+		st->reasons.list[st->reasons.len].status = status;
+		st->reasons.list[st->reasons.len].count = 1;
+		st->reasons.len++;
+	} else {
+		st->reasons.other++;
+	}
+}
+
+/* Nothing is logged per exit, a crash loop would flood the error log */
+static
+void
+service_exited(const pid_t pid, const int status, void * data) {
+	struct vector * directories = data;
+	struct statistics * st;
+	int * idx;
+
+	idx = table_find(&services_by_pid, pid);
+	if (idx == NULL)
+		return;
+
+	st = vector_item(directories, *idx);
+	table_remove(&services_by_pid, pid);
+
+	if (WIFSIGNALED(status)) {
+		st->exits.signal++;
+		count_exit_reason(st, -WTERMSIG(status));
+	} else if (WEXITSTATUS(status)) {
+		st->exits.error++;
+		count_exit_reason(st, WEXITSTATUS(status));
+	} else {
+		st->exits.clean++;
+	}
+}
+
+static
+void
+add_usage(struct proc_usage * sum, const struct proc_usage * usage) {
+	sum->cpu += usage->cpu + usage->cpu_children;
+	sum->rss += usage->rss;
+	sum->threads += usage->threads;
+	sum->fds += usage->fds;
+}
+
+static
+int
+compare_pids(const void * a, const void * b) {
+	const pid_t x = *(const pid_t *)a;
+	const pid_t y = *(const pid_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Children seen in the previous tick are read through their kept descriptors
+ * like the supervised process. The cache and the pids are both sorted, so
+ * they are matched in one pass, which closes descriptors of exited children
+ * and opens new ones while MAX_CHILD_HANDLES allows. */
+static
+void
+collect_children(struct statistics * st, const pid_t * pids, const int n, struct proc_usage * sum) {
+	static struct vector next = VECTOR_EMPTY;
+	struct proc_fds * cached;
+	struct proc_usage child;
+	struct proc_fds p;
+	struct vector tmp;
+	size_t j = 0;
+	int i;
+
+	if ((!vector_is_init(&st->children) && vector_init(&st->children, sizeof p) != ND_SUCCESS)
+			|| (!vector_is_init(&next) && vector_init(&next, sizeof p) != ND_SUCCESS)) {
+		for (i = 0; i < n; i++)
+			if (proc_read_pid(pids[i], &child) == ND_SUCCESS)
+				add_usage(sum, &child);
+		return;
+	}
+	cached = st->children.data;
+
+	for (i = 0; i < n; i++) {
+		for (; j < st->children.len && cached[j].pid < pids[i]; j++) {
+			proc_close(&cached[j]);
+			child_handles--;
+		}
+
+		if (j < st->children.len && cached[j].pid == pids[i]) {
+			p = cached[j++];
+		} else if (child_handles < MAX_CHILD_HANDLES) {
+			p = (struct proc_fds)PROC_FDS_EMPTY;
+			if (proc_open(&p, pids[i]) != ND_SUCCESS)
+				continue;
+			child_handles++;
+		} else {
+			if (proc_read_pid(pids[i], &child) == ND_SUCCESS)
+				add_usage(sum, &child);
+			continue;
+		}
+
+		if (proc_read(&p, &child) != ND_SUCCESS || vector_add(&next, &p) != ND_SUCCESS) {
+			proc_close(&p);
+			child_handles--;
+			continue;
+		}
+		add_usage(sum, &child);
+	}
+
+	for (; j < st->children.len; j++) {
+		proc_close(&cached[j]);
+		child_handles--;
+	}
+
+	tmp = st->children;
+	st->children = next;
+	next = tmp;
+	next.len = 0;
+}
+
+/* The supervised process is read through descriptors kept open until its pid
+ * changes. The CPU time of exited children moves to cutime and cstime of the
+ * parent. */
+static
+void
+collect_usage(struct statistics * st, const int children) {
+	static pid_t pids[MAX_CHILDREN];
+	struct proc_usage usage;
+	int n;
+
+	st->has_usage = 0;
+	if (!st->data.pid) {
+		proc_close(&st->proc);
+		close_children(st);
+		return;
+	}
+
+	if (st->proc.pid != st->data.pid && proc_open(&st->proc, st->data.pid) != ND_SUCCESS) {
+		close_children(st);
+		return;
+	}
+
+	if (proc_read(&st->proc, &st->usage) != ND_SUCCESS) {
+		proc_close(&st->proc);
+		close_children(st);
+		return;
+	}
+	st->has_usage = 1;
+
+	if (!children) {
+		st->usage.cpu_children = 0;
+		return;
+	}
+
+	memset(&usage, 0, sizeof usage);
+	add_usage(&usage, &st->usage);
+
+	n = proc_children(st->data.pid, pids, MAX_CHILDREN);
+	if (n > MAX_CHILDREN)
+		n = MAX_CHILDREN;
+	if (n > 0) {
+		qsort(pids, n, sizeof * pids, &compare_pids);
+		collect_children(st, pids, n, &usage);
+	} else {
+		close_children(st);
+	}
+
+	st->usage = usage;
+	st->usage.cpu_children = 0;
+}
+
+static
+void
+collect_resources(struct vector * directories, const int children) {
+	struct statistics * st;
+	int i;
+
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (st->removed)
+			continue;
+		/* Without the status the pid may be gone */
+		if (st->data.err == SUCCESS) {
+			collect_usage(st, children);
+		} else {
+			st->has_usage = 0;
+			proc_close(&st->proc);
+			close_children(st);
+		}
+	}
+}
+
+/* Bytes written by multilog are the growth of its current file. The file is
+ * held by an O_PATH descriptor, so after a rotation the final size of the old
+ * file is still known by fstat and the new current is counted from zero. Lines
+ * are never read. */
+static
+void
+collect_log(struct statistics * st, const char * log_dir) {
+	char path[PATH_MAX];
+	struct stat stat;
+
+	if (st->log.dir == -1) {
+		/* Most services log, but it is not an error not to */
+		snprintf(path, sizeof path, "%s/%s", st->name, log_dir);
+		st->log.dir = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+		if (st->log.dir == -1)
+			return;
+	}
+
+	if (st->log.file != -1 && fstat(st->log.file, &stat) == 0 && stat.st_size > st->log.size) {
+		st->log.bytes += stat.st_size - st->log.size;
+		st->log.size = stat.st_size;
+	}
+
+	if (fstatat(st->log.dir, "current", &stat, 0) == -1) {
+		close_log(st);
+		return;
+	}
+
+	if (st->log.file == -1 || stat.st_ino != st->log.ino) {
+		if (st->log.file != -1) {
+			close(st->log.file);
+			st->log.size = 0;
+		} else {
+			/* The first read is the base of the counter */
+			st->log.size = stat.st_size;
+		}
+		st->log.file = openat(st->log.dir, "current", O_PATH | O_CLOEXEC);
+		if (st->log.file == -1) {
+			close_log(st);
+			return;
+		}
+		st->log.ino = stat.st_ino;
+	}
+
+	/* A truncated file is counted from its new size */
+	if (stat.st_size > st->log.size)
+		st->log.bytes += stat.st_size - st->log.size;
+	st->log.size = stat.st_size;
+	st->has_log = 1;
+}
+
+static
+void
+collect_logs(struct vector * directories, const char * log_dir) {
+	struct statistics * st;
+	int i;
+
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (!st->removed)
+			collect_log(st, log_dir);
+	}
+}
+
+static
+const char *
+signal_name(const int sig) {
+	switch (sig) {
+	case SIGHUP:  return "SIGHUP";
+	case SIGINT:  return "SIGINT";
+	case SIGQUIT: return "SIGQUIT";
+	case SIGILL:  return "SIGILL";
+	case SIGABRT: return "SIGABRT";
+	case SIGBUS:  return "SIGBUS";
+	case SIGFPE:  return "SIGFPE";
+	case SIGKILL: return "SIGKILL";
+	case SIGSEGV: return "SIGSEGV";
+	case SIGPIPE: return "SIGPIPE";
+	case SIGALRM: return "SIGALRM";
+	case SIGTERM: return "SIGTERM";
+	}
+	return NULL;
+}
+
+static
+void
+exit_reason_id(char * id, const size_t size, const int status) {
+	if (status < 0)
+		snprintf(id, size, "signal_%d", -status);
+	else
+		snprintf(id, size, "code_%d", status);
+}
+
+/* The chart of a service is created by its first failed exit, a new reason
+ * adds its dimension by repeating the chart definition. */
+static
+void
+print_exit_reasons(struct statistics * st, const unsigned long last_update) {
+	char title[BUFSIZ];
+	char id[32];
+	int i;
+
+	if (!st->reasons.len)
+		return;
+
+	if (st->reasons.announced < st->reasons.len) {
+		snprintf(title, sizeof title, "Service Failed Exits of %s", st->name);
+		nd_chart("daemontools", "exits", st->name, NULL, title, "exits",
+			"daemontools", "daemontools.exit_reasons", ND_CHART_TYPE_STACKED);
+		if (!st->reasons.announced)
+			nd_dimension("other", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		for (i = st->reasons.announced; i < st->reasons.len; i++) {
+			exit_reason_id(id, sizeof id, st->reasons.list[i].status);
+			nd_dimension(id, st->reasons.list[i].status < 0 ? signal_name(-st->reasons.list[i].status) : NULL,
+				ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		}
+		st->reasons.announced = st->reasons.len;
+	}
+
+	nd_begin_time("daemontools", "exits", st->name, last_update);
+	for (i = 0; i < st->reasons.len; i++) {
+		exit_reason_id(id, sizeof id, st->reasons.list[i].status);
+		nd_set(id, st->reasons.list[i].count);
+	}
+	nd_set("other", st->reasons.other);
+	nd_end();
+}
+
+static
+void
+clear_exit_reasons(struct vector * directories) {
+	struct statistics * st;
+	int i, j;
+
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		for (j = 0; j < st->reasons.len; j++)
+			st->reasons.list[j].count = 0;
+		st->reasons.other = 0;
+	}
+}
+
+static
+int
+print_statistics(struct vector * directories, const unsigned long last_update,
+		const unsigned long lateness, const uint64_t missed) {
+	const time_t now = tai_now();
+	struct statistics * st;
+	int i;
+
+	nd_begin_time("daemontools", "uptime", NULL, last_update);
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (st->data.err == SUCCESS && st->data.is_up) {
+			nd_set(st->name, now - st->data.timestamp);
+		}
+	}
+	nd_end();
+
+	nd_begin_time("daemontools", "downtime", NULL, last_update);
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (st->data.err == SUCCESS) {
+			nd_set(st->name, !st->data.is_up ? now - st->data.timestamp : 0);
+		}
+	}
+	nd_end();
+
+	nd_begin_time("daemontools", "up_down", NULL, last_update);
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (st->data.err == SUCCESS) {
+			nd_set(st->name, st->data.is_up);
+		}
+	}
+	nd_end();
+
+	nd_begin_time("daemontools", "restarts", NULL, last_update);
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (!st->removed)
+			nd_set(st->name, st->restarts.total);
+	}
+	nd_end();
+
+	nd_begin_time("daemontools", "restarts_1m", NULL, last_update);
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (!st->removed) {
+			restarts_advance(&st->restarts);
+			nd_set(st->name, st->restarts.sum_1m);
+		}
+	}
+	nd_end();
+
+	nd_begin_time("daemontools", "restarts_10m", NULL, last_update);
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (!st->removed)
+			nd_set(st->name, st->restarts.sum_10m);
+	}
+	nd_end();
+
+	nd_begin_time("daemontools", "cpu", NULL, last_update);
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (st->has_usage)
+			nd_set(st->name, st->usage.cpu * 100 / clock_ticks);
+	}
+	nd_end();
+
+	nd_begin_time("daemontools", "memory", NULL, last_update);
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (st->has_usage)
+			nd_set(st->name, st->usage.rss * page_size / 1024);
+	}
+	nd_end();
+
+	nd_begin_time("daemontools", "threads", NULL, last_update);
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (st->has_usage)
+			nd_set(st->name, st->usage.threads);
+	}
+	nd_end();
+
+	nd_begin_time("daemontools", "fds", NULL, last_update);
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (st->has_usage)
+			nd_set(st->name, st->usage.fds);
+	}
+	nd_end();
+
+	nd_begin_time("daemontools", "log", NULL, last_update);
+	for (i = 0; i < directories->len; i++) {
+		st = vector_item(directories, i);
+		if (st->has_log)
+			nd_set(st->name, st->log.bytes);
+	}
+	nd_end();
+
+	if (table_is_init(&services_by_pid)) {
+		nd_begin_time("daemontools", "exits_clean", NULL, last_update);
+		for (i = 0; i < directories->len; i++) {
+			st = vector_item(directories, i);
+			if (!st->removed)
+				nd_set(st->name, st->exits.clean);
+		}
+		nd_end();
+
+		nd_begin_time("daemontools", "exits_error", NULL, last_update);
+		for (i = 0; i < directories->len; i++) {
+			st = vector_item(directories, i);
+			if (!st->removed)
+				nd_set(st->name, st->exits.error);
+		}
+		nd_end();
+
+		nd_begin_time("daemontools", "exits_signal", NULL, last_update);
+		for (i = 0; i < directories->len; i++) {
+			st = vector_item(directories, i);
+			if (!st->removed)
+				nd_set(st->name, st->exits.signal);
+		}
+		nd_end();
+
+		for (i = 0; i < directories->len; i++) {
+			st = vector_item(directories, i);
+			if (!st->removed)
+				print_exit_reasons(st, last_update);
+		}
+	}
+
+	nd_begin_time("daemontools", "tick", NULL, last_update);
+	nd_set("lateness", lateness);
+	nd_set("missed", missed);
+	nd_end();
+
+	return fflush(stdout) == EOF;
 }
 
 int
 main(int argc, char * argv[]) {
 	struct vector directories = VECTOR_EMPTY;
-	struct statistics statistics;
+	struct pollfd pfd[POLL_LENGTH];
 	unsigned long last_update;
 	struct timespec timestamp;
-	struct dirent * dir_entry;
-	const char * dir_name;
+	unsigned long lateness;
+	uint64_t expirations;
+	const char * log_dir;
 	const char * argv0;
 	const char * path;
 	int timeout = 1;
-	int dir_fd;
-	DIR * dir;
+	int fs_event_fd;
+	int cnproc_fd;
+	int signal_fd;
+	int root_watch;
+	int timer_fd;
+	int children;
+	int run;
 
 	path = DEFAULT_PATH;
 	argv0 = *argv; argv++; argc--;
@@ -136,115 +1104,114 @@ main(int argc, char * argv[]) {
 		exit(1);
 	}
 
-	signal(SIGQUIT, quit);
-	signal(SIGTERM, quit);
-	signal(SIGINT, quit);
+	timer_fd = prepare_timer_fd(timeout);
+	pfd[POLL_TIMER].fd = timer_fd;
+	pfd[POLL_TIMER].events = POLLIN;
 
-	vector_init(&directories, sizeof statistics);
-	memset(&statistics, 0, sizeof statistics);
+	signal_fd = prepare_signal_fd();
+	pfd[POLL_SIGNAL].fd = signal_fd;
+	pfd[POLL_SIGNAL].events = POLLIN;
 
-	dir = opendir(".");
-	while ((dir_entry = readdir(dir))) {
-		dir_name = dir_entry->d_name;
+	clock_ticks = sysconf(_SC_CLK_TCK);
+	page_size = sysconf(_SC_PAGESIZE);
+	children = env_int("SVSTAT_CHILDREN", 0, 0, 1);
+	log_dir = getenv("SVSTAT_LOG_DIR");
+	if (log_dir == NULL || !*log_dir)
+		log_dir = DEFAULT_LOG_DIR;
 
-		if (dir_name[0] == '.')
-			continue;
+	fs_event_fd = prepare_fs_event_fd();
+	pfd[POLL_FS_EVENT].fd = fs_event_fd;
+	pfd[POLL_FS_EVENT].events = POLLIN;
 
-		if (is_directory(dir_name) == 1) {
-			statistics.name = strdup(dir_name);
-			if (statistics.name) {
-				vector_add(&directories, &statistics);
-			}
+	vector_init(&directories, sizeof(struct statistics));
+
+	/* Exit codes are known only from the proc connector, svstat works without */
+	cnproc_fd = -1;
+	if (env_int("SVSTAT_PROC_CONNECTOR", 1, 0, 1)) {
+		cnproc_fd = prepare_cnproc_fd();
+		if (cnproc_fd != -1 && table_init(&services_by_pid, sizeof(int)) != ND_SUCCESS) {
+			close_cnproc_fd(cnproc_fd);
+			cnproc_fd = -1;
 		}
 	}
-	closedir(dir);
+	pfd[POLL_CNPROC].fd = cnproc_fd;
+	pfd[POLL_CNPROC].events = POLLIN;
+
+	root_watch = inotify_add_watch(fs_event_fd, ".", IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM);
+	if (root_watch == -1)
+		fprintf(stderr, "Cannot watch '%s', new services are not detected: %s\n", path, strerror(errno));
+
+	scan_services(&directories, fs_event_fd, 0);
 
 	if (vector_is_empty(&directories)) {
 		fprintf(stderr, "No service directory detected\n");
 		exit(1);
 	}
 
-	dir_fd = open(".", O_DIRECTORY | O_RDONLY | O_NDELAY);
-	if (dir_fd == -1) {
-		fprintf(stderr, "Cannot open directory '%s': %s\n", path, strerror(errno));
-		exit(1);
-	}
-
-	nd_chart("daemontools", "uptime", NULL, NULL, "Service Uptime", "seconds", "daemontools", "daemontools.uptime", ND_CHART_TYPE_LINE);
-	for (int i = 0; i < directories.len; i++) {
-		struct statistics * st = vector_item(&directories, i);
-		nd_dimension(st->name, st->name, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
-	}
-
-	nd_chart("daemontools", "downtime", NULL, NULL, "Service Downtime", "seconds", "daemontools", "daemontools.downtime", ND_CHART_TYPE_LINE);
-	for (int i = 0; i < directories.len; i++) {
-		struct statistics * st = vector_item(&directories, i);
-		nd_dimension(st->name, st->name, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
-	}
-
-	nd_chart("daemontools", "up_down", NULL, NULL, "Service Up/Down", "up/down", "daemontools", "daemontools.up_down", ND_CHART_TYPE_LINE);
-	for (int i = 0; i < directories.len; i++) {
-		struct statistics * st = vector_item(&directories, i);
-		nd_dimension(st->name, st->name, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
-	}
+	print_charts(&directories, NULL, ND_VISIBLE);
+	nd_chart("daemontools", "tick", NULL, NULL, "Plugin Tick Lateness", "microseconds",
+		"plugin", "daemontools.tick", ND_CHART_TYPE_LINE);
+	nd_dimension("lateness", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+	nd_dimension("missed", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
 	fflush(stdout);
 
 	clock_gettime(CLOCK_REALTIME, &timestamp);
 
 	for (run = 1; run;) {
-		/* Collect statistics */
-		for (int i = 0; i < directories.len; i++) {
-			struct statistics * st = vector_item(&directories, i);
-			memset(&st->data, 0, sizeof st->data);
-			collect_uptime(st);
-			if (fchdir(dir_fd) == -1) {
-				fprintf(stderr, "Cannot change directory back to '%s': %s\n", path, strerror(errno));
-				break;
+		switch (poll(pfd, LEN(pfd), -1)) {
+		case -1:
+			perror("poll");
+			break;
+		case 0:
+			fputs("timeout\n", stderr);
+			continue;
+		default:
+			if (pfd[POLL_SIGNAL].revents & POLLIN) {
+				flush_read_fd(signal_fd);
+				run = 0;
+				continue;
 			}
-		}
-
-		/* Present statistics */
-		last_update = update_timestamp(&timestamp);
-		time_t now = tai_now();
-
-		nd_begin_time("daemontools", "uptime", NULL, last_update);
-		for (int i = 0; i < directories.len; i++) {
-			struct statistics * st = vector_item(&directories, i);
-			if (st->data.err == SUCCESS && st->data.is_up) {
-				nd_set(st->name, now - st->data.timestamp);
+			/* A lost event is reported as POLLERR, recv clears it */
+			if (pfd[POLL_CNPROC].revents & (POLLIN | POLLERR))
+				process_cnproc_events(cnproc_fd, service_exited, &directories);
+			/* Status changes are read as they come, not at the next tick */
+			if (pfd[POLL_FS_EVENT].revents & POLLIN) {
+				process_status_events(fs_event_fd, root_watch, &directories);
+				collect_services(&directories, fs_event_fd);
 			}
-		}
-		nd_end();
+			if (pfd[POLL_TIMER].revents & POLLIN) {
+				lateness = timer_lateness(timeout);
+				if (read(timer_fd, &expirations, sizeof expirations) != sizeof expirations)
+					expirations = 1;
 
-		nd_begin_time("daemontools", "downtime", NULL, last_update);
-		for (int i = 0; i < directories.len; i++) {
-			struct statistics * st = vector_item(&directories, i);
-			if (st->data.err == SUCCESS) {
-				nd_set(st->name, !st->data.is_up ? now - st->data.timestamp : 0);
-			}
-		}
-		nd_end();
+				collect_services(&directories, fs_event_fd);
+				collect_resources(&directories, children);
+				collect_logs(&directories, log_dir);
 
-		nd_begin_time("daemontools", "up_down", NULL, last_update);
-		for (int i = 0; i < directories.len; i++) {
-			struct statistics * st = vector_item(&directories, i);
-			if (st->data.err == SUCCESS) {
-				nd_set(st->name, st->data.is_up);
+				last_update = update_timestamp(&timestamp);
+				if (print_statistics(&directories, last_update, lateness, expirations - 1)) {
+					fprintf(stderr, "Cannot write to stdout: %s\n", strerror(errno));
+					run = 0;
+				}
+				clear_exit_reasons(&directories);
 			}
 		}
-		nd_end();
-
-		if (fflush(stdout) == EOF) {
-			fprintf(stderr, "Cannot write to stdout: %s\n", strerror(errno));
-			break;
-		}
-
-		sleep(timeout);
 	}
-	close(dir_fd);
+
 	for (int i = 0; i < directories.len; i++) {
-		free((void *)((struct statistics *)vector_item(&directories, i))->name);
+		struct statistics * st = vector_item(&directories, i);
+		close_supervise(st, fs_event_fd);
+		proc_close(&st->proc);
+		close_children(st);
+		vector_free(&st->children);
+		close_log(st);
+		free((void *)st->name);
 	}
+	close_cnproc_fd(cnproc_fd);
+	table_free(&services_by_pid);
+	close(fs_event_fd);
+	close(timer_fd);
+	close(signal_fd);
 	vector_free(&directories);
 	return 0;
 }
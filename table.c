@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "hash.h"
+#include "table.h"
+
+static
+enum nd_err
+table_alloc(struct table * t, const size_t cap) {
+	if (!(t->keys = calloc(cap, sizeof * t->keys))) {
+		return ND_ALLOC;
+	}
+	if (!(t->data = calloc(cap, t->size))) {
+		free(t->keys);
+		t->keys = NULL;
+		return ND_ALLOC;
+	}
+	t->cap = cap;
+	t->len = 0;
+	return ND_SUCCESS;
+}
+
+enum nd_err
+table_init(struct table * t, const size_t s) {
+	static const size_t INITIAL_CAPACITY = 64;
+
+	t->size = s;
+	return table_alloc(t, INITIAL_CAPACITY);
+}
+
+static inline
+size_t
+table_home(const struct table * t, const uint64_t key) {
+	return hash_u64(key) & (t->cap - 1);
+}
+
+static
+size_t
+table_slot(const struct table * t, const uint64_t key) {
+	size_t i;
+
+	for (i = table_home(t, key); t->keys[i] && t->keys[i] != key; i = (i + 1) & (t->cap - 1))
+		;
+
+	return i;
+}
+
+void *
+table_find(struct table * t, const uint64_t key) {
+	size_t i = table_slot(t, key);
+
+	return t->keys[i] ? table_item(t, i) : NULL;
+}
+
+/* The table grows when it is filled from 3/4. */
+static
+enum nd_err
+table_resize(struct table * t) {
+	struct table old = *t;
+	size_t i, j;
+
+	if ((t->len + 1) * 4 <= t->cap * 3)
+		return ND_SUCCESS;
+
+	if (table_alloc(t, old.cap * 2) != ND_SUCCESS) {
+		*t = old;
+		return ND_ALLOC;
+	}
+
+	for (i = 0; i < old.cap; i++) {
+		if (old.keys[i]) {
+			j = table_slot(t, old.keys[i]);
+			t->keys[j] = old.keys[i];
+			memcpy(table_item(t, j), table_item(&old, i), t->size);
+			t->len++;
+		}
+	}
+
+	free(old.keys);
+	free(old.data);
+	return ND_SUCCESS;
+}
+
+/* Returns value of the key. The new value is zeroed if the key is not present
+ * in the table. NULL is returned if the table cannot grow. */
+void *
+table_insert(struct table * t, const uint64_t key) {
+	size_t i = table_slot(t, key);
+
+	if (t->keys[i])
+		return table_item(t, i);
+
+	if (table_resize(t) != ND_SUCCESS)
+		return NULL;
+
+	i = table_slot(t, key);
+	t->keys[i] = key;
+	memset(table_item(t, i), 0, t->size);
+	t->len++;
+
+	return table_item(t, i);
+}
+
+/* Backward shift deletion, no tombstones are left in the table. The slot
+ * idx may be occupied by a following item afterwards, so the caller iterating
+ * over the table has to check the slot again. */
+void
+table_remove_at(struct table * t, size_t idx) {
+	const size_t mask = t->cap - 1;
+	size_t i, home;
+
+	t->keys[idx] = 0;
+	t->len--;
+
+	for (i = (idx + 1) & mask; t->keys[i]; i = (i + 1) & mask) {
+		home = table_home(t, t->keys[i]);
+		/* Move the item only if its home slot is not between the hole and
+		 * its current position. */
+		if (((i - home) & mask) >= ((i - idx) & mask)) {
+			t->keys[idx] = t->keys[i];
+			memcpy(table_item(t, idx), table_item(t, i), t->size);
+			t->keys[i] = 0;
+			idx = i;
+		}
+	}
+}
+
+void
+table_remove(struct table * t, const uint64_t key) {
+	size_t i = table_slot(t, key);
+
+	if (t->keys[i])
+		table_remove_at(t, i);
+}
+
+void
+table_clear(struct table * t) {
+	memset(t->keys, 0, t->cap * sizeof * t->keys);
+	t->len = 0;
+}
+
+void
+table_free(struct table * t) {
+	free(t->keys);
+	free(t->data);
+	t->keys = NULL;
+	t->data = NULL;
+}
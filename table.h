@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+/* Open addressing hash table with linear probing. Keys are 64 bit integers,
+ * values have fixed size. Key 0 marks an empty slot, so it cannot be stored. */
+struct table {
+	size_t cap;      /* number of slots, always power of two */
+	size_t size;     /* size of one value */
+	size_t len;      /* number of used slots */
+	uint64_t * keys; /* keys of slots */
+	void * data;     /* values of slots */
+};
+
+#define TABLE_EMPTY { .cap = 0, .size = 0, .len = 0, .keys = NULL, .data = NULL }
+
+static inline
+int
+table_is_init(struct table * t) {
+	return t && t->keys;
+}
+
+static inline
+void *
+table_item(struct table * t, const size_t idx) {
+	return (char *)t->data + idx * t->size;
+}
+
+enum nd_err
+table_init(struct table *, const size_t);
+
+void *
+table_find(struct table *, const uint64_t);
+
+void *
+table_insert(struct table *, const uint64_t);
+
+void
+table_remove_at(struct table *, size_t);
+
+void
+table_remove(struct table *, const uint64_t);
+
+void
+table_clear(struct table *);
+
+void
+table_free(struct table *);
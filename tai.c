@@ -0,0 +1,76 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <stdint.h>
+#include <time.h>
+
+#include "tai.h"
+
+/* TAI64 label of the UNIX epoch, including the 10 leap seconds of 1970 as
+ * tai64nlocal of daemontools counts them. */
+#define TAI64_EPOCH 4611686018427387914ULL
+
+static inline
+int
+hex_value(const char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* Converts the TAI64N label at the beginning of the line to microseconds of
+ * UNIX time. It returns 0 on success and -1 if the line has no label. */
+int
+tai64n_parse(const char * line, uint64_t * us) {
+	uint64_t sec = 0;
+	uint32_t nsec = 0;
+	int i, v;
+
+	if (line[0] != '@')
+		return -1;
+
+	for (i = 1; i < 17; i++) {
+		if ((v = hex_value(line[i])) < 0)
+			return -1;
+		sec = sec << 4 | v;
+	}
+	for (; i < TAI64N_LENGTH; i++) {
+		if ((v = hex_value(line[i])) < 0)
+			return -1;
+		nsec = nsec << 4 | v;
+	}
+
+	if (sec < TAI64_EPOCH)
+		return -1;
+
+	*us = (sec - TAI64_EPOCH) * 1000000 + nsec / 1000;
+	return 0;
+}
+
+/* Backfill runs the modules on the time of the log instead of the clock */
+static uint64_t fixed_now;
+
+void
+tai_set_now(const uint64_t us) {
+	fixed_now = us;
+}
+
+/* The time set by tai_set_now(), 0 outside of backfill */
+uint64_t
+tai_fixed_now() {
+	return fixed_now;
+}
+
+uint64_t
+tai_now_us() {
+	struct timespec now;
+
+	if (fixed_now)
+		return fixed_now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
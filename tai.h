@@ -0,0 +1,9 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+/* Length of "@" followed by TAI64N label in hex, as written by multilog t */
+#define TAI64N_LENGTH 25
+
+int tai64n_parse(const char *, uint64_t *);
+uint64_t tai_now_us();
+void tai_set_now(const uint64_t);
+uint64_t tai_fixed_now();
@@ -0,0 +1,355 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "callbacks.h"
+#include "err.h"
+#include "netdata.h"
+#include "proc.h"
+#include "vector.h"
+#include "tcpserver.h"
+
+/* tcpserver processes are searched in /proc once per RESCAN_TICKS ticks and
+ * whenever a known one disappears. */
+#define RESCAN_TICKS 60
+
+/* Concurrency limit of tcpserver without -c */
+#define DEFAULT_CONCURRENCY 40
+
+#define SERVER_NAME_MAX 64
+
+/* Options of tcpserver taking an argument */
+#define OPTIONS_WITH_ARG "xtTuglbBc"
+
+struct tcpserver {
+	char name[SERVER_NAME_MAX]; /* service of supervise or the port */
+	pid_t pid;
+	int limit;
+	int sessions;               /* -1 if the process is gone */
+	int announced;
+	int seen;
+};
+
+struct tcpserver_statistics {
+	struct vector servers;
+	int rescan;                 /* ticks to the next search */
+};
+
+static
+void *
+tcpserver_data_init() {
+	struct tcpserver_statistics * ret;
+
+	ret = calloc(1, sizeof * ret);
+	if (ret == NULL)
+		return NULL;
+
+	if (vector_init(&ret->servers, sizeof(struct tcpserver)) != ND_SUCCESS) {
+		free(ret);
+		return NULL;
+	}
+
+	return ret;
+}
+
+static
+void
+tcpserver_data_fini(struct tcpserver_statistics * data) {
+	vector_free(&data->servers);
+	free(data);
+}
+
+static
+void
+set_name(char * name, const char * src, const size_t len) {
+	size_t i;
+
+	for (i = 0; i < len && i < SERVER_NAME_MAX - 1 && src[i]; i++)
+		name[i] = isalnum((unsigned char)src[i]) || src[i] == '-' ? src[i] : '_';
+	name[i] = '\0';
+}
+
+/* The arguments are separated by '\0'. Options end by the first argument not
+ * starting by '-', which is the host followed by the port. */
+static
+void
+parse_cmdline(const char * buf, const size_t len, int * limit, const char ** host, const char ** port) {
+	const char * end = buf + len;
+	const char * value;
+	const char * arg;
+	const char * opt;
+	int options = 1;
+
+	*limit = DEFAULT_CONCURRENCY;
+	*host = NULL;
+	*port = NULL;
+
+	arg = memchr(buf, '\0', len);
+	for (arg = arg ? arg + 1 : end; arg < end; arg += strlen(arg) + 1) {
+		if (*host) {
+			*port = arg;
+			return;
+		}
+		if (!options || arg[0] != '-' || !arg[1]) {
+			*host = arg;
+			continue;
+		}
+		if (!strcmp(arg, "--")) {
+			options = 0;
+			continue;
+		}
+		for (opt = arg + 1; *opt; opt++) {
+			if (!strchr(OPTIONS_WITH_ARG, *opt))
+				continue;
+			if (opt[1]) {
+				value = opt + 1;
+			} else {
+				arg += strlen(arg) + 1;
+				if (arg >= end)
+					return;
+				value = arg;
+			}
+			if (*opt == 'c')
+				*limit = atoi(value);
+			break;
+		}
+	}
+}
+
+/* tcpserver takes 0 for any address */
+static
+int
+is_any_address(const char * host) {
+	return !strcmp(host, "0") || !strcmp(host, "0.0.0.0") || !strcmp(host, "::");
+}
+
+/* Services of daemontools are named by the argument of their supervise, other
+ * servers by their port, prefixed by the address unless they listen on any.
+ * Servers on the same port and different addresses so stay apart. A forked
+ * child of tcpserver has the same comm until it executes the program, it gets
+ * no name. */
+static
+void
+name_server(struct tcpserver * server, const pid_t pid, const char * host, const char * port) {
+	char name[SERVER_NAME_MAX];
+	char buf[BUFSIZ];
+	char comm[32];
+	const char * ptr;
+	ssize_t len;
+	long ppid;
+
+	server->name[0] = '\0';
+
+	len = proc_read_file(pid, "stat", buf, sizeof buf - 1);
+	if (len <= 0)
+		return;
+	buf[len] = '\0';
+
+	/* ") S ppid ..." */
+	ptr = strrchr(buf, ')');
+	if (ptr == NULL || sscanf(ptr, ") %*c %ld", &ppid) != 1)
+		return;
+
+	len = proc_read_file(ppid, "comm", comm, sizeof comm);
+	if (len == sizeof "tcpserver" && !memcmp(comm, "tcpserver\n", len))
+		return;
+
+	if (len == sizeof "supervise" && !memcmp(comm, "supervise\n", len)) {
+		len = proc_read_file(ppid, "cmdline", buf, sizeof buf - 1);
+		if (len > 0) {
+			buf[len] = '\0';
+			ptr = buf + strlen(buf) + 1;
+			if (ptr < buf + len)
+				set_name(server->name, ptr, strlen(ptr));
+		}
+	}
+
+	if (!server->name[0] && port) {
+		if (host && !is_any_address(host))
+			snprintf(name, sizeof name, "%s_%s", host, port);
+		else
+			snprintf(name, sizeof name, "%s", port);
+		set_name(server->name, name, strlen(name));
+	}
+}
+
+static
+struct tcpserver *
+find_server(struct vector * servers, const char * name) {
+	struct tcpserver * server;
+	int i;
+
+	for (i = 0; i < servers->len; i++) {
+		server = vector_item(servers, i);
+		if (!strcmp(server->name, name))
+			return server;
+	}
+
+	return NULL;
+}
+
+static
+void
+add_server(struct vector * servers, const pid_t pid) {
+	struct tcpserver server, * known;
+	char buf[BUFSIZ];
+	const char * host;
+	const char * port;
+	ssize_t len;
+
+	memset(&server, 0, sizeof server);
+
+	len = proc_read_file(pid, "cmdline", buf, sizeof buf - 1);
+	if (len <= 0)
+		return;
+	buf[len] = '\0';
+
+	parse_cmdline(buf, len, &server.limit, &host, &port);
+	name_server(&server, pid, host, port);
+	if (!server.name[0])
+		return;
+
+	server.pid = pid;
+	server.seen = 1;
+
+	known = find_server(servers, server.name);
+	if (known) {
+		known->pid = server.pid;
+		known->limit = server.limit;
+		known->seen = 1;
+		return;
+	}
+
+	fprintf(stderr, "tcpserver detected: %s (pid %d, limit %d)\n", server.name, (int)pid, server.limit);
+	vector_add(servers, &server);
+}
+
+/* Only comm is read for every process, stat and cmdline for tcpservers. */
+static
+void
+scan_servers(struct vector * servers) {
+	struct dirent * de;
+	char comm[32];
+	DIR * dir;
+	pid_t pid;
+	int i;
+
+	dir = opendir("/proc");
+	if (dir == NULL) {
+		perror("opendir /proc");
+		return;
+	}
+
+	for (i = 0; i < servers->len; i++)
+		((struct tcpserver *)vector_item(servers, i))->seen = 0;
+
+	while ((de = readdir(dir))) {
+		if (!isdigit((unsigned char)de->d_name[0]))
+			continue;
+		pid = atoi(de->d_name);
+		if (proc_read_file(pid, "comm", comm, sizeof comm) == sizeof "tcpserver"
+				&& !memcmp(comm, "tcpserver\n", sizeof "tcpserver"))
+			add_server(servers, pid);
+	}
+	closedir(dir);
+
+	for (i = 0; i < servers->len; i++) {
+		struct tcpserver * server = vector_item(servers, i);
+		if (!server->seen)
+			server->pid = 0;
+	}
+}
+
+/* Every child of tcpserver is one session, so the concurrency is the length
+ * of its children list. It does not depend on the connection rate. */
+static
+int
+count_sessions(struct vector * servers) {
+	struct tcpserver * server;
+	int lost = 0;
+	int i;
+
+	for (i = 0; i < servers->len; i++) {
+		server = vector_item(servers, i);
+		server->sessions = server->pid ? proc_children(server->pid, NULL, 0) : -1;
+		if (server->pid && server->sessions < 0) {
+			server->pid = 0;
+			lost = 1;
+		}
+	}
+
+	return lost;
+}
+
+static
+void
+measure_tcpservers(const char * unused, struct tcpserver_statistics * data) {
+	if (--data->rescan <= 0 || count_sessions(&data->servers)) {
+		scan_servers(&data->servers);
+		count_sessions(&data->servers);
+		data->rescan = RESCAN_TICKS;
+	}
+}
+
+static
+int
+print_tcpserver_hdr(const char * name) {
+	return fflush(stdout);
+}
+
+static
+int
+print_tcpserver_data(const char * name, struct tcpserver_statistics * data, const unsigned long time) {
+	struct tcpserver * server;
+	char title[BUFSIZ];
+	int i;
+
+	for (i = 0; i < data->servers.len; i++) {
+		server = vector_item(&data->servers, i);
+
+		if (!server->announced) {
+			if (server->sessions < 0)
+				continue;
+			sprintf(title, "Qmail tcpserver sessions for %s", server->name);
+			nd_chart("qmail", "tcpserver", server->name, "", title, "sessions",
+				"tcpserver", "qmail.tcpserver_sessions", ND_CHART_TYPE_LINE);
+			nd_dimension("sessions", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+			nd_dimension("limit", NULL, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+			server->announced = 1;
+		}
+
+		/* Values are left empty while tcpserver is not running */
+		nd_begin_time("qmail", "tcpserver", server->name, time);
+		if (server->sessions >= 0) {
+			nd_set("sessions", server->sessions);
+			nd_set("limit", server->limit);
+		}
+		nd_end();
+	}
+
+	return fflush(stdout);
+}
+
+static
+void
+clear_data(struct tcpserver_statistics * data) {
+}
+
+static
+struct stat_func tcpserver = {
+	.init = &tcpserver_data_init,
+	.fini = (void (*)(void *))&tcpserver_data_fini,
+
+	.print_hdr   = &print_tcpserver_hdr,
+	.print       = (int (*)(const char *, const void *, unsigned long))&print_tcpserver_data,
+	.process     = (void (*)(const char *, void *))&measure_tcpservers,
+	.clear       = (void (*)(void *))&clear_data,
+};
+
+struct stat_func * tcpserver_func = &tcpserver;
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../err.h"
+#include "../vector.h"
+#include "../wheel.h"
+
+#define LEN 8
+#define TIMEOUT 4
+
+/* Slot of every id, 0 once it expired */
+static uint64_t pending[4];
+
+static
+void
+expire(uint64_t id, uint64_t slot, void * unused) {
+	if (pending[id] && pending[id] <= slot)
+		pending[id] = 0;
+}
+
+static
+int
+check(const int cond, const char * what) {
+	if (!cond)
+		fprintf(stderr, "wheel: %s\n", what);
+	return !cond;
+}
+
+static
+void
+add(struct wheel * w, const uint64_t id, const uint64_t slot) {
+	pending[id] = slot;
+	wheel_add(w, slot, id);
+}
+
+int
+main() {
+	struct wheel w;
+	int failed = 0;
+
+	if (wheel_init(&w, LEN, 1, TIMEOUT) != ND_SUCCESS)
+		return 1;
+
+	/* Ids of the first tick */
+	add(&w, 1, 1000);
+	add(&w, 2, 1000);
+	wheel_expire(&w, 1000, expire, NULL);
+	failed |= check(pending[1] && pending[2], "ids of the first tick expired early");
+	wheel_expire(&w, 1000 + TIMEOUT - 1, expire, NULL);
+	failed |= check(pending[1] && pending[2], "ids of the first tick expired before the timeout");
+	wheel_expire(&w, 1000 + TIMEOUT, expire, NULL);
+	failed |= check(!pending[1] && !pending[2], "ids of the first tick did not expire");
+
+	/* Ids of the first tick after a gap longer than the wheel */
+	add(&w, 3, 2000);
+	wheel_expire(&w, 2000, expire, NULL);
+	failed |= check(pending[3], "id after a gap expired early");
+	wheel_expire(&w, 2000 + TIMEOUT, expire, NULL);
+	failed |= check(!pending[3], "id after a gap did not expire");
+
+	/* Ids added while time goes back expire with the next turn of their slot */
+	wheel_expire(&w, 1500, expire, NULL);
+	add(&w, 1, 1500);
+	wheel_expire(&w, 2000 + TIMEOUT + LEN, expire, NULL);
+	failed |= check(!pending[1], "id added while time went back did not expire");
+
+	wheel_free(&w);
+	return failed;
+}
@@ -4,14 +4,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/timerfd.h>
+#include <time.h>
 
 #include "timer.h"
 
+/* Seconds between ticks, modules size their time slots by it */
+static int interval = 1;
+
+/* The first expiration is aligned to a multiple of the timeout, so ticks of
+ * all plugins happen at the same wall clock time. */
 int
 prepare_timer_fd(const int timeout) {
 	struct itimerspec tv;
+	struct timespec now;
 	int ret, fd;
 
+	if (timeout < 1) {
+		fprintf(stderr, "E: Invalid timeout %d\n", timeout);
+		exit(1);
+	}
+
 	fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
 
 	if (fd == -1) {
@@ -19,11 +31,14 @@ prepare_timer_fd(const int timeout) {
 		exit(1);
 	}
 
+	interval = timeout;
+	clock_gettime(CLOCK_REALTIME, &now);
+
 	memset(&tv, 0, sizeof tv);
 	tv.it_interval.tv_sec = timeout;
-	tv.it_value.tv_sec = timeout;
+	tv.it_value.tv_sec = (now.tv_sec / timeout + 1) * timeout;
 
-	ret = timerfd_settime(fd, 0, &tv, NULL);
+	ret = timerfd_settime(fd, TFD_TIMER_ABSTIME, &tv, NULL);
 
 	if (ret == -1) {
 		perror("E: Cannot set timer");
@@ -33,6 +48,21 @@ prepare_timer_fd(const int timeout) {
 	return fd;
 }
 
+/* Microseconds elapsed since the aligned tick which should have woken us. */
+unsigned long
+timer_lateness(const int timeout) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	return (now.tv_sec % timeout) * 1000000 + now.tv_nsec / 1000;
+}
+
+int
+timer_interval() {
+	return interval;
+}
+
 unsigned long
 update_timestamp(struct timespec * now) {
 	struct timespec old, tmp;
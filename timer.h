@@ -2,4 +2,8 @@
 
 int prepare_timer_fd(const int);
 
+unsigned long timer_lateness(const int);
+
+int timer_interval();
+
 unsigned long update_timestamp(struct timespec *);
@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "netdata.h"
+#include "topn.h"
+
+enum nd_err
+topn_init(struct topn * t, const size_t n) {
+	t->n = n;
+	t->len = 0;
+	t->shown_len = 0;
+	t->changed = 0;
+	t->dropped_len = 0;
+	t->items = calloc(n, sizeof * t->items);
+	t->shown = calloc(n, sizeof * t->shown);
+	t->dropped = calloc(n, sizeof * t->dropped);
+	if (t->items == NULL || t->shown == NULL || t->dropped == NULL) {
+		topn_free(t);
+		return ND_ALLOC;
+	}
+	return ND_SUCCESS;
+}
+
+static
+void
+set_item(struct topn_item * item, const char * name, size_t len, const long value) {
+	size_t i;
+
+	if (len >= TOPN_NAME_MAX)
+		len = TOPN_NAME_MAX - 1;
+
+	for (i = 0; i < len; i++) {
+		item->name[i] = name[i];
+		item->id[i] = isalnum((unsigned char)name[i]) || name[i] == '-' ? name[i] : '_';
+	}
+	item->name[len] = '\0';
+	item->id[len] = '\0';
+	item->value = value;
+}
+
+void
+topn_offer(struct topn * t, const char * name, const size_t len, const long value) {
+	size_t i;
+
+	if (t->n == 0 || (t->len == t->n && t->items[t->len - 1].value >= value))
+		return;
+
+	if (t->len < t->n)
+		t->len++;
+
+	for (i = t->len - 1; i > 0 && t->items[i - 1].value < value; i--)
+		t->items[i] = t->items[i - 1];
+
+	set_item(t->items + i, name, len, value);
+}
+
+void
+topn_clear(struct topn * t) {
+	t->len = 0;
+}
+
+static
+int
+topn_contains(const struct topn_item * items, const size_t len, const char * id) {
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (!strcmp(items[i].id, id))
+			return 1;
+
+	return 0;
+}
+
+void
+topn_update(struct topn * t) {
+	size_t i;
+
+	t->changed = t->len != t->shown_len;
+	for (i = 0; i < t->len && !t->changed; i++)
+		t->changed = !topn_contains(t->shown, t->shown_len, t->items[i].id);
+
+	t->dropped_len = 0;
+	if (!t->changed)
+		return;
+
+	for (i = 0; i < t->shown_len; i++)
+		if (!topn_contains(t->items, t->len, t->shown[i].id))
+			t->dropped[t->dropped_len++] = t->shown[i];
+
+	memcpy(t->shown, t->items, t->len * sizeof * t->items);
+	t->shown_len = t->len;
+}
+
+void
+topn_print(const struct topn * t, const char * type, const char * prefix, const char * id,
+		const char * title, const char * units, const char * family, const char * context,
+		const unsigned long time) {
+	size_t i;
+
+	if (t->changed) {
+		nd_chart(type, prefix, id, "", title, units, family, context, ND_CHART_TYPE_STACKED);
+		for (i = 0; i < t->len; i++)
+			nd_dimension(t->items[i].id, t->items[i].name, ND_ALG_ABSOLUTE, 1, 1, ND_VISIBLE);
+		for (i = 0; i < t->dropped_len; i++)
+			nd_dimension(t->dropped[i].id, t->dropped[i].name, ND_ALG_ABSOLUTE, 1, 1, ND_OBSOLETE);
+	}
+
+	if (t->len == 0)
+		return;
+
+	nd_begin_time(type, prefix, id, time);
+	for (i = 0; i < t->len; i++)
+		nd_set(t->items[i].id, t->items[i].value);
+	nd_end();
+}
+
+void
+topn_free(struct topn * t) {
+	free(t->items);
+	free(t->shown);
+	free(t->dropped);
+	t->items = NULL;
+	t->shown = NULL;
+	t->dropped = NULL;
+}
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#define TOPN_NAME_MAX 256
+
+struct topn_item {
+	char id[TOPN_NAME_MAX];   /* dimension id, netdata safe */
+	char name[TOPN_NAME_MAX]; /* dimension name */
+	long value;
+};
+
+/* Chart with at most n dimensions holding the biggest values offered during
+ * the tick. Dimensions which drop out are marked obsolete, so the number of
+ * live dimensions in netdata stays bounded. The set of dimensions is updated
+ * after the tick's offers, printing only reads it. */
+struct topn {
+	size_t n;
+	size_t len;                /* number of offered items, at most n */
+	struct topn_item * items;  /* offered items, sorted by value */
+	size_t shown_len;          /* number of currently defined dimensions */
+	struct topn_item * shown;  /* currently defined dimensions */
+	int changed;               /* dimensions changed by the last update */
+	size_t dropped_len;        /* number of dimensions dropped by the update */
+	struct topn_item * dropped;
+};
+
+enum nd_err topn_init(struct topn *, const size_t);
+void topn_offer(struct topn *, const char *, const size_t, const long);
+void topn_clear(struct topn *);
+void topn_update(struct topn *);
+void topn_print(const struct topn *, const char *, const char *, const char *,
+	const char *, const char *, const char *, const char *, const unsigned long);
+void topn_free(struct topn *);
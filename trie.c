@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "trie.h"
+
+/* Longest supported address, IPv6 */
+#define TRIE_BYTES 16
+
+enum nd_err
+trie_init(struct trie * t, const uint32_t cap, const unsigned depth) {
+	t->cap = cap < 1 ? 1 : cap;
+	t->depth = depth > TRIE_BYTES * 8 ? TRIE_BYTES * 8 : depth;
+	t->nodes = malloc(t->cap * sizeof * t->nodes);
+	if (t->nodes == NULL)
+		return ND_ALLOC;
+
+	trie_clear(t);
+	return ND_SUCCESS;
+}
+
+static inline
+int
+addr_bit(const uint8_t * addr, const unsigned bit) {
+	return addr[bit >> 3] >> (7 - (bit & 7)) & 1;
+}
+
+/* Every node on the path is counted, so the count of any prefix is read from
+ * its node. The walk takes at most depth steps. */
+void
+trie_add(struct trie * t, const uint8_t * addr, const int counter) {
+	struct trie_node * node = t->nodes;
+	uint32_t * child;
+	unsigned bit;
+
+	node->count[counter]++;
+	for (bit = 0; bit < t->depth; bit++) {
+		child = &node->child[addr_bit(addr, bit)];
+		if (!*child) {
+			if (t->len == t->cap) {
+				t->dropped++;
+				return;
+			}
+			*child = t->len++;
+			memset(t->nodes + *child, 0, sizeof * t->nodes);
+		}
+		node = t->nodes + *child;
+		node->count[counter]++;
+	}
+}
+
+static
+void
+walk(const struct trie * t, const uint32_t idx, const unsigned bit, const unsigned depth, uint8_t * prefix,
+		void (*visit)(const uint8_t *, const uint32_t *, void *), void * data) {
+	const struct trie_node * node = t->nodes + idx;
+	int b;
+
+	if (bit == depth) {
+		visit(prefix, node->count, data);
+		return;
+	}
+
+	for (b = 0; b < 2; b++) {
+		if (!node->child[b])
+			continue;
+		if (b)
+			prefix[bit >> 3] |= 1 << (7 - (bit & 7));
+		else
+			prefix[bit >> 3] &= ~(1 << (7 - (bit & 7)));
+		walk(t, node->child[b], bit + 1, depth, prefix, visit, data);
+	}
+	prefix[bit >> 3] &= ~(1 << (7 - (bit & 7)));
+}
+
+/* Calls visit for every prefix of the given length with its counters. The
+ * prefix is passed with the host bits zeroed. */
+void
+trie_walk(const struct trie * t, const unsigned depth,
+		void (*visit)(const uint8_t *, const uint32_t *, void *), void * data) {
+	uint8_t prefix[TRIE_BYTES];
+
+	if (depth > t->depth)
+		return;
+
+	memset(prefix, 0, sizeof prefix);
+	walk(t, 0, 0, depth, prefix, visit, data);
+}
+
+void
+trie_clear(struct trie * t) {
+	memset(t->nodes, 0, sizeof * t->nodes);
+	t->len = 1;
+	t->dropped = 0;
+}
+
+void
+trie_free(struct trie * t) {
+	free(t->nodes);
+	t->nodes = NULL;
+}
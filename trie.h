@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#define TRIE_COUNTERS 2
+
+/* Node of a binary trie of address bits. Children are indices into the node
+ * pool, 0 means no child as the root cannot be a child. */
+struct trie_node {
+	uint32_t child[2];
+	uint32_t count[TRIE_COUNTERS];
+};
+
+/* Binary trie counting addresses by all their prefixes up to depth bits. Nodes
+ * are taken from a pool of fixed size, which is emptied at once by
+ * trie_clear(). Addresses which do not fit are counted in dropped. */
+struct trie {
+	struct trie_node * nodes;
+	uint32_t len;
+	uint32_t cap;
+	unsigned depth;
+	long dropped;
+};
+
+enum nd_err trie_init(struct trie *, const uint32_t, const unsigned);
+void trie_add(struct trie *, const uint8_t *, const int);
+void trie_walk(const struct trie *, const unsigned,
+	void (*)(const uint8_t *, const uint32_t *, void *), void *);
+void trie_clear(struct trie *);
+void trie_free(struct trie *);
@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "err.h"
+#include "vector.h"
+#include "wheel.h"
+
+enum nd_err
+wheel_init(struct wheel * w, const size_t len, const uint64_t width, const uint64_t timeout) {
+	size_t i;
+
+	w->slots = calloc(len, sizeof * w->slots);
+	if (w->slots == NULL)
+		return ND_ALLOC;
+
+	for (i = 0; i < len; i++) {
+		if (vector_init(&w->slots[i], sizeof(uint64_t)) != ND_SUCCESS) {
+			while (i--)
+				vector_free(&w->slots[i]);
+			free(w->slots);
+			w->slots = NULL;
+			return ND_ALLOC;
+		}
+	}
+
+	w->len = len;
+	w->width = width;
+	w->timeout = timeout;
+	w->expired = 0;
+	return ND_SUCCESS;
+}
+
+uint64_t
+wheel_slot(const struct wheel * w, const uint64_t time) {
+	return time / w->width;
+}
+
+enum nd_err
+wheel_add(struct wheel * w, const uint64_t slot, const uint64_t id) {
+	return vector_add(&w->slots[slot % w->len], &id);
+}
+
+/* Calls expire for every id of the slots older than timeout. The first call
+ * and a gap longer than the wheel only move the expired slot, the ids left in
+ * the wheel are older than any slot visited later, so they expire when their
+ * slot turns up. Nothing expires while time goes back. */
+void
+wheel_expire(struct wheel * w, const uint64_t now, void (*expire)(uint64_t, uint64_t, void *), void * data) {
+	const uint64_t slot = wheel_slot(w, now);
+	struct vector * ids;
+	size_t i;
+
+	if (!w->expired || slot > w->expired + w->timeout + w->len)
+		w->expired = slot - w->timeout - 1;
+
+	while (w->expired + w->timeout < slot) {
+		ids = &w->slots[++w->expired % w->len];
+		for (i = 0; i < ids->len; i++)
+			expire(*(uint64_t *)vector_item(ids, i), w->expired, data);
+		ids->len = 0;
+	}
+}
+
+void
+wheel_free(struct wheel * w) {
+	size_t i;
+
+	for (i = 0; i < w->len; i++)
+		vector_free(&w->slots[i]);
+	free(w->slots);
+	w->slots = NULL;
+}
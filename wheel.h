@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+
+/* Timer wheel of ids by the slot of their start. Finished ids stay in their
+ * slot, the callback of the expiry checks whether an id is still pending in
+ * that slot. */
+struct wheel {
+	struct vector * slots;
+	size_t len;          /* number of slots, more than timeout */
+	uint64_t width;      /* microseconds of one slot */
+	uint64_t timeout;    /* slots before an id expires */
+	uint64_t expired;    /* last expired slot, 0 before the first expiry */
+};
+
+enum nd_err wheel_init(struct wheel *, const size_t, const uint64_t, const uint64_t);
+uint64_t wheel_slot(const struct wheel *, const uint64_t);
+enum nd_err wheel_add(struct wheel *, const uint64_t, const uint64_t);
+void wheel_expire(struct wheel *, const uint64_t, void (*)(uint64_t, uint64_t, void *), void *);
+void wheel_free(struct wheel *);